@@ -0,0 +1,67 @@
+#include "alloc_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> AllocationCount(0);
+
+size_t
+AllocCounter::GetCount() {
+    return AllocationCount.load(std::memory_order_relaxed);
+}
+
+void*
+operator new(size_t size) {
+    AllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* Memory = std::malloc(size ? size : 1)) {
+        return Memory;
+    }
+    throw std::bad_alloc();
+}
+
+void*
+operator new[](size_t size) {
+    return operator new(size);
+}
+
+void*
+operator new(size_t size, const std::nothrow_t&) noexcept {
+    AllocationCount.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void*
+operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void
+operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void
+operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void
+operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void
+operator delete[](void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void
+operator delete(void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+void
+operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
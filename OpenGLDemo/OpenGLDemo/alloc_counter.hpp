@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts calls to the global operator new, which alloc_counter.cpp replaces.
+// Take the difference of two readings to see how often a block allocates.
+class AllocCounter {
+
+public:
+    static size_t GetCount();
+};
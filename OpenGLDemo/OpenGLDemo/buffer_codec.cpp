@@ -0,0 +1,91 @@
+#include "buffer_codec.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+// PackBits style control bytes: values below 128 copy the next (value + 1)
+// bytes, larger values repeat the next byte (value - 125) times.
+static const unsigned MAX_LITERAL = 128;
+static const unsigned MIN_REPEAT = 3;
+static const unsigned MAX_REPEAT = 130;
+
+std::vector<unsigned char>
+BufferCodec::Compress(const void* words, size_t wordCount, unsigned stride) {
+    std::vector<uint32_t> Words(wordCount);
+    if (wordCount) {
+        std::memcpy(Words.data(), words, wordCount * sizeof(uint32_t));
+    }
+
+    std::vector<unsigned char> Planes(wordCount * 4);
+    for (size_t i = 0; i < wordCount; ++i) {
+        const uint32_t Delta = Words[i] ^ (i >= stride ? Words[i - stride] : 0u);
+        for (unsigned Plane = 0; Plane < 4; ++Plane) {
+            Planes[Plane * wordCount + i] = static_cast<unsigned char>(Delta >> (24 - 8 * Plane));
+        }
+    }
+
+    std::vector<unsigned char> Packed;
+    Packed.reserve(Planes.size() / 2);
+    size_t Position = 0;
+    while (Position < Planes.size()) {
+        size_t Run = 1;
+        while (Position + Run < Planes.size() && Run < MAX_REPEAT && Planes[Position + Run] == Planes[Position]) {
+            ++Run;
+        }
+        if (Run >= MIN_REPEAT) {
+            Packed.push_back(static_cast<unsigned char>(Run + 125));
+            Packed.push_back(Planes[Position]);
+            Position += Run;
+            continue;
+        }
+
+        // Gather literals until the next run long enough to be worth encoding
+        size_t LiteralEnd = Position;
+        while (LiteralEnd < Planes.size() && LiteralEnd - Position < MAX_LITERAL) {
+            if (LiteralEnd + 2 < Planes.size() && Planes[LiteralEnd] == Planes[LiteralEnd + 1] && Planes[LiteralEnd] == Planes[LiteralEnd + 2]) {
+                break;
+            }
+            ++LiteralEnd;
+        }
+        Packed.push_back(static_cast<unsigned char>(LiteralEnd - Position - 1));
+        Packed.insert(Packed.end(), Planes.begin() + Position, Planes.begin() + LiteralEnd);
+        Position = LiteralEnd;
+    }
+    Packed.shrink_to_fit();
+    return Packed;
+}
+
+bool
+BufferCodec::Decompress(const std::vector<unsigned char>& packed, void* words, size_t wordCount, unsigned stride) {
+    std::vector<unsigned char> Planes;
+    Planes.reserve(wordCount * 4);
+    size_t Position = 0;
+    while (Position < packed.size()) {
+        const unsigned Control = packed[Position++];
+        if (Control < MAX_LITERAL) {
+            if (Position + Control + 1 > packed.size()) return false;
+            Planes.insert(Planes.end(), packed.begin() + Position, packed.begin() + Position + Control + 1);
+            Position += Control + 1;
+        }
+        else {
+            if (Position >= packed.size()) return false;
+            Planes.insert(Planes.end(), Control - 125, packed[Position++]);
+        }
+    }
+    if (Planes.size() != wordCount * 4) {
+        return false;
+    }
+
+    std::vector<uint32_t> Words(wordCount);
+    for (size_t i = 0; i < wordCount; ++i) {
+        uint32_t Delta = 0;
+        for (unsigned Plane = 0; Plane < 4; ++Plane) {
+            Delta |= static_cast<uint32_t>(Planes[Plane * wordCount + i]) << (24 - 8 * Plane);
+        }
+        Words[i] = Delta ^ (i >= stride ? Words[i - stride] : 0u);
+    }
+    if (wordCount) {
+        std::memcpy(words, Words.data(), wordCount * sizeof(uint32_t));
+    }
+    return true;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Lossless packing for buffers of 32-bit words such as interleaved vertices
+// or indices. Each word is XORed with the word one stride earlier, the result
+// is split into byte planes and the planes are run-length encoded. Neighbouring
+// vertices share most of their high bytes, which is where the savings come from.
+class BufferCodec {
+
+public:
+    static std::vector<unsigned char> Compress(const void* words, size_t wordCount, unsigned stride);
+    static bool Decompress(const std::vector<unsigned char>& packed, void* words, size_t wordCount, unsigned stride);
+};
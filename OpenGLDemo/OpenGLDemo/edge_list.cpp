@@ -0,0 +1,45 @@
+#include "edge_list.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+
+EdgeList::EdgeList(const VertexWeld& weld, const std::vector<unsigned>& indices) {
+    // Edge by its ordered pair of groups, mapped to its first index in mIndices
+    std::unordered_map<uint64_t, size_t> Edges;
+    Edges.reserve(indices.size());
+    mIndices.reserve(indices.size() * 2);
+    for (size_t Triangle = 0; Triangle + 2 < indices.size(); Triangle += 3) {
+        for (unsigned Corner = 0; Corner < 3; ++Corner) {
+            const unsigned GroupA = weld.GetGroup(indices[Triangle + Corner]);
+            const unsigned GroupB = weld.GetGroup(indices[Triangle + (Corner + 1) % 3]);
+            const unsigned Opposite = indices[Triangle + (Corner + 2) % 3];
+            if (GroupA == GroupB) {
+                continue;
+            }
+
+            // A second triangle running the other way closes the edge
+            const uint64_t Reverse = static_cast<uint64_t>(GroupB) << 32 | GroupA;
+            auto It = Edges.find(Reverse);
+            if (It != Edges.end()) {
+                mIndices[It->second + 3] = Opposite;
+                Edges.erase(It);
+                continue;
+            }
+
+            const unsigned A = weld.GetFirstVertex(GroupA);
+            const unsigned B = weld.GetFirstVertex(GroupB);
+            Edges[static_cast<uint64_t>(GroupA) << 32 | GroupB] = mIndices.size();
+            mIndices.insert(mIndices.end(), { Opposite, A, B, A });
+        }
+    }
+}
+
+const std::vector<unsigned>&
+EdgeList::GetIndices() const {
+    return mIndices;
+}
+
+unsigned
+EdgeList::GetEdgeCount() const {
+    return static_cast<unsigned>(mIndices.size() / 4);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include "vertex_weld.hpp"
+
+// Unique edges of a triangle list as GL_LINES_ADJACENCY indices. Every edge is
+// listed once as (C1, A, B, C2): the line runs from A to B, C1 is the opposite
+// corner of the first triangle, which winds A to B, and C2 the one of the
+// second triangle, which winds B to A. Boundary edges repeat A as C2, so their
+// missing second triangle is degenerate and never faces the camera. Edges are
+// matched through the weld groups of their ends and use the first vertex of
+// each group, so an edge split by seams in the vertex data is still one line.
+// Edges shared by more than two triangles, or by two with opposite windings,
+// are listed again for each further triangle.
+class EdgeList {
+
+private:
+    std::vector<unsigned> mIndices;
+
+public:
+    EdgeList(const VertexWeld& weld, const std::vector<unsigned>& indices);
+    const std::vector<unsigned>& GetIndices() const;
+    unsigned GetEdgeCount() const;
+};
@@ -0,0 +1,126 @@
+#include "frustum.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <xmmintrin.h>
+#endif
+
+#define CULL_BATCH 8
+
+Frustum::Frustum(const glm::mat4& modelViewProjection) {
+    // Gribb and Hartmann: each plane is the last row plus or minus another
+    const glm::mat4 Rows = glm::transpose(modelViewProjection);
+    mPlanes[0] = Rows[3] + Rows[0];
+    mPlanes[1] = Rows[3] - Rows[0];
+    mPlanes[2] = Rows[3] + Rows[1];
+    mPlanes[3] = Rows[3] - Rows[1];
+    mPlanes[4] = Rows[3] + Rows[2];
+    mPlanes[5] = Rows[3] - Rows[2];
+    for (glm::vec4& Plane : mPlanes) {
+        const float Length = glm::length(glm::vec3(Plane));
+        if (Length > 0.0f) {
+            Plane /= Length;
+        }
+    }
+}
+
+const glm::vec4&
+Frustum::GetPlane(unsigned plane) const {
+    return mPlanes[plane];
+}
+
+bool
+Frustum::Intersects(const BoundingSphere& sphere) const {
+    for (const glm::vec4& Plane : mPlanes) {
+        if (glm::dot(glm::vec3(Plane), sphere.Center) + Plane.w < -sphere.Radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+FrustumCuller::Build(const std::vector<BoundingBox>& boxes) {
+    mCount = static_cast<unsigned>(boxes.size());
+    const size_t Padded = (boxes.size() + CULL_BATCH - 1) / CULL_BATCH * CULL_BATCH;
+    for (std::vector<float>* Array : { &mCenterX, &mCenterY, &mCenterZ, &mExtentX, &mExtentY, &mExtentZ }) {
+        Array->assign(Padded, 0.0f);
+    }
+    for (size_t Box = 0; Box < boxes.size(); ++Box) {
+        const glm::vec3 Center = 0.5f * (boxes[Box].Max + boxes[Box].Min);
+        const glm::vec3 Extent = 0.5f * (boxes[Box].Max - boxes[Box].Min);
+        mCenterX[Box] = Center.x;
+        mCenterY[Box] = Center.y;
+        mCenterZ[Box] = Center.z;
+        mExtentX[Box] = Extent.x;
+        mExtentY[Box] = Extent.y;
+        mExtentZ[Box] = Extent.z;
+    }
+}
+
+void
+FrustumCuller::Cull(const Frustum& frustum, std::vector<unsigned char>& visible) const {
+    visible.resize(mCount);
+    // A box is outside when even its corner furthest along the plane normal is
+    // behind the plane: dot(n, c) + w + dot(|n|, e) < 0
+    for (unsigned First = 0; First < mCount; First += CULL_BATCH) {
+        unsigned Outside = 0;
+#if defined(__AVX__)
+        const __m256 CenterX = _mm256_loadu_ps(&mCenterX[First]);
+        const __m256 CenterY = _mm256_loadu_ps(&mCenterY[First]);
+        const __m256 CenterZ = _mm256_loadu_ps(&mCenterZ[First]);
+        const __m256 ExtentX = _mm256_loadu_ps(&mExtentX[First]);
+        const __m256 ExtentY = _mm256_loadu_ps(&mExtentY[First]);
+        const __m256 ExtentZ = _mm256_loadu_ps(&mExtentZ[First]);
+        __m256 OutsideMask = _mm256_setzero_ps();
+        for (unsigned PlaneIdx = 0; PlaneIdx < 6; ++PlaneIdx) {
+            const glm::vec4& Plane = frustum.GetPlane(PlaneIdx);
+            __m256 Distance = _mm256_set1_ps(Plane.w);
+            Distance = _mm256_add_ps(Distance, _mm256_mul_ps(_mm256_set1_ps(Plane.x), CenterX));
+            Distance = _mm256_add_ps(Distance, _mm256_mul_ps(_mm256_set1_ps(Plane.y), CenterY));
+            Distance = _mm256_add_ps(Distance, _mm256_mul_ps(_mm256_set1_ps(Plane.z), CenterZ));
+            Distance = _mm256_add_ps(Distance, _mm256_mul_ps(_mm256_set1_ps(std::abs(Plane.x)), ExtentX));
+            Distance = _mm256_add_ps(Distance, _mm256_mul_ps(_mm256_set1_ps(std::abs(Plane.y)), ExtentY));
+            Distance = _mm256_add_ps(Distance, _mm256_mul_ps(_mm256_set1_ps(std::abs(Plane.z)), ExtentZ));
+            OutsideMask = _mm256_or_ps(OutsideMask, _mm256_cmp_ps(Distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        Outside = static_cast<unsigned>(_mm256_movemask_ps(OutsideMask));
+#else
+        for (unsigned Half = 0; Half < CULL_BATCH; Half += 4) {
+            const unsigned Box = First + Half;
+            const __m128 CenterX = _mm_loadu_ps(&mCenterX[Box]);
+            const __m128 CenterY = _mm_loadu_ps(&mCenterY[Box]);
+            const __m128 CenterZ = _mm_loadu_ps(&mCenterZ[Box]);
+            const __m128 ExtentX = _mm_loadu_ps(&mExtentX[Box]);
+            const __m128 ExtentY = _mm_loadu_ps(&mExtentY[Box]);
+            const __m128 ExtentZ = _mm_loadu_ps(&mExtentZ[Box]);
+            __m128 OutsideMask = _mm_setzero_ps();
+            for (unsigned PlaneIdx = 0; PlaneIdx < 6; ++PlaneIdx) {
+                const glm::vec4& Plane = frustum.GetPlane(PlaneIdx);
+                __m128 Distance = _mm_set1_ps(Plane.w);
+                Distance = _mm_add_ps(Distance, _mm_mul_ps(_mm_set1_ps(Plane.x), CenterX));
+                Distance = _mm_add_ps(Distance, _mm_mul_ps(_mm_set1_ps(Plane.y), CenterY));
+                Distance = _mm_add_ps(Distance, _mm_mul_ps(_mm_set1_ps(Plane.z), CenterZ));
+                Distance = _mm_add_ps(Distance, _mm_mul_ps(_mm_set1_ps(std::abs(Plane.x)), ExtentX));
+                Distance = _mm_add_ps(Distance, _mm_mul_ps(_mm_set1_ps(std::abs(Plane.y)), ExtentY));
+                Distance = _mm_add_ps(Distance, _mm_mul_ps(_mm_set1_ps(std::abs(Plane.z)), ExtentZ));
+                OutsideMask = _mm_or_ps(OutsideMask, _mm_cmplt_ps(Distance, _mm_setzero_ps()));
+            }
+            Outside |= static_cast<unsigned>(_mm_movemask_ps(OutsideMask)) << Half;
+        }
+#endif
+        const unsigned Last = std::min(First + CULL_BATCH, mCount);
+        for (unsigned Box = First; Box < Last; ++Box) {
+            visible[Box] = !((Outside >> (Box - First)) & 1);
+        }
+    }
+}
+
+unsigned
+FrustumCuller::GetCount() const {
+    return mCount;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+struct BoundingBox {
+    glm::vec3 Min = glm::vec3(0.0f);
+    glm::vec3 Max = glm::vec3(0.0f);
+};
+
+struct BoundingSphere {
+    glm::vec3 Center = glm::vec3(0.0f);
+    float Radius = 0.0f;
+};
+
+struct CullStats {
+    unsigned Visible;
+    unsigned Culled;
+};
+
+// The six clipping planes of a view-projection matrix, pointing inwards. With
+// the model matrix folded in the planes are in model space, so bounds never
+// have to be transformed.
+class Frustum {
+
+private:
+    glm::vec4 mPlanes[6];
+
+public:
+    explicit Frustum(const glm::mat4& modelViewProjection);
+    const glm::vec4& GetPlane(unsigned plane) const;
+    bool Intersects(const BoundingSphere& sphere) const;
+};
+
+// Boxes stored as centers and extents in separate arrays, padded to a multiple
+// of eight, so eight of them are tested against a plane at once: with AVX in
+// one register, otherwise in two SSE ones.
+class FrustumCuller {
+
+private:
+    std::vector<float> mCenterX;
+    std::vector<float> mCenterY;
+    std::vector<float> mCenterZ;
+    std::vector<float> mExtentX;
+    std::vector<float> mExtentY;
+    std::vector<float> mExtentZ;
+    unsigned mCount = 0;
+
+public:
+    void Build(const std::vector<BoundingBox>& boxes);
+    // Writes 1 for every box that is at least partly inside, 0 otherwise
+    void Cull(const Frustum& frustum, std::vector<unsigned char>& visible) const;
+    unsigned GetCount() const;
+};
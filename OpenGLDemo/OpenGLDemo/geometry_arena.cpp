@@ -0,0 +1,366 @@
+#include "geometry_arena.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+unsigned
+RangeAllocator::Allocate(unsigned count) {
+    for (auto It = mFree.begin(); It != mFree.end(); ++It) {
+        if (It->second < count) {
+            continue;
+        }
+        const unsigned Offset = It->first;
+        const unsigned Remaining = It->second - count;
+        mFree.erase(It);
+        if (Remaining) {
+            mFree[Offset + count] = Remaining;
+        }
+        mUsed += count;
+        return Offset;
+    }
+    return INVALID_OFFSET;
+}
+
+void
+RangeAllocator::Free(unsigned offset, unsigned count) {
+    if (!count) {
+        return;
+    }
+    mUsed -= count;
+    auto Next = mFree.lower_bound(offset);
+    if (Next != mFree.end() && offset + count == Next->first) {
+        count += Next->second;
+        Next = mFree.erase(Next);
+    }
+    if (Next != mFree.begin()) {
+        auto Previous = std::prev(Next);
+        if (Previous->first + Previous->second == offset) {
+            Previous->second += count;
+            return;
+        }
+    }
+    mFree[offset] = count;
+}
+
+void
+RangeAllocator::Grow(unsigned capacity) {
+    if (capacity <= mCapacity) {
+        return;
+    }
+    const unsigned Added = capacity - mCapacity;
+    const unsigned Offset = mCapacity;
+    mCapacity = capacity;
+    // Counted as used so that Free can merge it like any other range
+    mUsed += Added;
+    Free(Offset, Added);
+}
+
+unsigned
+RangeAllocator::GetCapacity() const {
+    return mCapacity;
+}
+
+unsigned
+RangeAllocator::GetUsed() const {
+    return mUsed;
+}
+
+unsigned GeometryArena::sVertexArray = 0;
+unsigned GeometryArena::sInstancedVertexArray = 0;
+unsigned GeometryArena::sVertexBuffer = 0;
+unsigned GeometryArena::sIndexBuffer = 0;
+RangeAllocator GeometryArena::sVertices;
+RangeAllocator GeometryArena::sIndices;
+RenderStats GeometryArena::sStats = { 0, 0 };
+
+void
+GeometryArena::create() {
+    glGenVertexArrays(1, &sVertexArray);
+    grow(sVertexBuffer, 0, static_cast<size_t>(ARENA_INITIAL_VERTICES) * ARENA_VERTEX_FLOATS * sizeof(float));
+    grow(sIndexBuffer, 0, static_cast<size_t>(ARENA_INITIAL_INDICES) * sizeof(unsigned));
+    sVertices.Grow(ARENA_INITIAL_VERTICES);
+    sIndices.Grow(ARENA_INITIAL_INDICES);
+    setupVertexArray(sVertexArray);
+}
+
+void
+GeometryArena::setupVertexArray(unsigned vertexArray) {
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, sVertexBuffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, ARENA_VERTEX_FLOATS * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, ARENA_VERTEX_FLOATS * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, ARENA_VERTEX_FLOATS * sizeof(float), (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sIndexBuffer);
+    glBindVertexArray(0);
+}
+
+void
+GeometryArena::grow(unsigned& buffer, size_t usedBytes, size_t capacityBytes) {
+    // The copy targets leave the element buffer binding of the bound vertex array alone
+    unsigned Grown;
+    glGenBuffers(1, &Grown);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, Grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacityBytes, nullptr, GL_STATIC_DRAW);
+    if (buffer) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffer = Grown;
+}
+
+unsigned
+GeometryArena::allocate(RangeAllocator& allocator, unsigned& buffer, size_t elementBytes, unsigned count) {
+    if (!sVertexArray) {
+        create();
+    }
+    unsigned Offset = allocator.Allocate(count);
+    if (Offset != RangeAllocator::INVALID_OFFSET) {
+        return Offset;
+    }
+    // Doubling keeps the number of copies logarithmic in the final size
+    unsigned Capacity = allocator.GetCapacity();
+    do {
+        Capacity = std::max(Capacity * 2, allocator.GetCapacity() + count);
+        RangeAllocator Trial = allocator;
+        Trial.Grow(Capacity);
+        Offset = Trial.Allocate(count);
+    } while (Offset == RangeAllocator::INVALID_OFFSET);
+    grow(buffer, allocator.GetCapacity() * elementBytes, Capacity * elementBytes);
+    allocator.Grow(Capacity);
+    setupVertexArray(sVertexArray);
+    if (sInstancedVertexArray) {
+        setupVertexArray(sInstancedVertexArray);
+    }
+    return allocator.Allocate(count);
+}
+
+ArenaAllocation
+GeometryArena::AllocateVertices(const float* vertices, unsigned count) {
+    ArenaAllocation Allocation;
+    if (!count) {
+        return Allocation;
+    }
+    const size_t VertexBytes = ARENA_VERTEX_FLOATS * sizeof(float);
+    Allocation.Offset = allocate(sVertices, sVertexBuffer, VertexBytes, count);
+    Allocation.Count = count;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, sVertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, Allocation.Offset * VertexBytes, count * VertexBytes, vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return Allocation;
+}
+
+ArenaAllocation
+GeometryArena::AllocateIndices(const unsigned* indices, unsigned count) {
+    ArenaAllocation Allocation;
+    if (!count) {
+        return Allocation;
+    }
+    Allocation.Offset = allocate(sIndices, sIndexBuffer, sizeof(unsigned), count);
+    Allocation.Count = count;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, sIndexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, Allocation.Offset * sizeof(unsigned), count * sizeof(unsigned), indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return Allocation;
+}
+
+ArenaAllocation
+GeometryArena::ReserveVertices(unsigned count) {
+    ArenaAllocation Allocation;
+    if (!count) {
+        return Allocation;
+    }
+    Allocation.Offset = allocate(sVertices, sVertexBuffer, ARENA_VERTEX_FLOATS * sizeof(float), count);
+    Allocation.Count = count;
+    return Allocation;
+}
+
+void
+GeometryArena::FreeVertices(ArenaAllocation& allocation) {
+    sVertices.Free(allocation.Offset, allocation.Count);
+    allocation = ArenaAllocation();
+}
+
+void
+GeometryArena::FreeIndices(ArenaAllocation& allocation) {
+    sIndices.Free(allocation.Offset, allocation.Count);
+    allocation = ArenaAllocation();
+}
+
+void
+GeometryArena::ReadVertices(const ArenaAllocation& allocation, float* vertices) {
+    const size_t VertexBytes = ARENA_VERTEX_FLOATS * sizeof(float);
+    glBindBuffer(GL_COPY_READ_BUFFER, sVertexBuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, allocation.Offset * VertexBytes, allocation.Count * VertexBytes, vertices);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void
+GeometryArena::ReadIndices(const ArenaAllocation& allocation, unsigned* indices) {
+    glBindBuffer(GL_COPY_READ_BUFFER, sIndexBuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, allocation.Offset * sizeof(unsigned), allocation.Count * sizeof(unsigned), indices);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void
+GeometryArena::MultiDraw(GLenum mode, const DrawRange* ranges, GLsizei count) {
+    if (!count) {
+        return;
+    }
+    // Kept between calls so drawing does not allocate once they are large enough
+    static std::vector<GLsizei> Counts;
+    static std::vector<const void*> Offsets;
+    static std::vector<GLint> BaseVertices;
+    Counts.clear();
+    Offsets.clear();
+    BaseVertices.clear();
+    for (GLsizei Draw = 0; Draw < count; ++Draw) {
+        Counts.push_back(ranges[Draw].Count);
+        Offsets.push_back(reinterpret_cast<const void*>(static_cast<size_t>(ranges[Draw].FirstIndex) * sizeof(unsigned)));
+        BaseVertices.push_back(ranges[Draw].BaseVertex);
+    }
+    glBindVertexArray(sVertexArray);
+    glMultiDrawElementsBaseVertex(mode, Counts.data(), GL_UNSIGNED_INT, Offsets.data(), count, BaseVertices.data());
+    glBindVertexArray(0);
+    CountDraws(1, 1);
+}
+
+void
+GeometryArena::MultiDrawArrays(GLenum mode, const DrawRange* ranges, GLsizei count) {
+    if (!count) {
+        return;
+    }
+    static std::vector<GLsizei> Counts;
+    static std::vector<GLint> FirstVertices;
+    Counts.clear();
+    FirstVertices.clear();
+    for (GLsizei Draw = 0; Draw < count; ++Draw) {
+        Counts.push_back(ranges[Draw].Count);
+        FirstVertices.push_back(ranges[Draw].BaseVertex);
+    }
+    glBindVertexArray(sVertexArray);
+    glMultiDrawArrays(mode, FirstVertices.data(), Counts.data(), count);
+    glBindVertexArray(0);
+    CountDraws(1, 1);
+}
+
+void
+GeometryArena::bindInstances(unsigned instanceBuffer, unsigned firstInstance, const float* localTransform) {
+    if (!sInstancedVertexArray) {
+        glGenVertexArrays(1, &sInstancedVertexArray);
+        setupVertexArray(sInstancedVertexArray);
+        glBindVertexArray(sInstancedVertexArray);
+        for (unsigned Column = 0; Column < 4; ++Column) {
+            glEnableVertexAttribArray(3 + Column);
+            glVertexAttribDivisor(3 + Column, 1);
+        }
+        glBindVertexArray(0);
+    }
+    glBindVertexArray(sInstancedVertexArray);
+    // The instance buffer can be a different one every frame, and base
+    // instances need GL 4.2, so the first instance is an attribute offset
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    const size_t FirstByte = static_cast<size_t>(firstInstance) * 16 * sizeof(float);
+    for (unsigned Column = 0; Column < 4; ++Column) {
+        glVertexAttribPointer(3 + Column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float), (void*)(FirstByte + Column * 4 * sizeof(float)));
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Locations 7 to 10 have no array, the shader reads the current value,
+    // which is context state and set for every draw
+    static const float Identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    const float* Local = localTransform ? localTransform : Identity;
+    for (unsigned Column = 0; Column < 4; ++Column) {
+        glVertexAttrib4fv(7 + Column, Local + Column * 4);
+    }
+}
+
+void
+GeometryArena::DrawInstanced(GLenum mode, const DrawRange* ranges, GLsizei count, unsigned instanceBuffer,
+    unsigned firstInstance, GLsizei instanceCount, const float* localTransform) {
+    if (!count || !instanceCount || !sVertexArray) {
+        return;
+    }
+    bindInstances(instanceBuffer, firstInstance, localTransform);
+    for (GLsizei Draw = 0; Draw < count; ++Draw) {
+        const void* Offset = reinterpret_cast<const void*>(static_cast<size_t>(ranges[Draw].FirstIndex) * sizeof(unsigned));
+        glDrawElementsInstancedBaseVertex(mode, ranges[Draw].Count, GL_UNSIGNED_INT, Offset, instanceCount, ranges[Draw].BaseVertex);
+    }
+    glBindVertexArray(0);
+    CountDraws(static_cast<unsigned>(count), 1);
+}
+
+void
+GeometryArena::DrawArraysInstanced(GLenum mode, const DrawRange* ranges, GLsizei count, unsigned instanceBuffer,
+    unsigned firstInstance, GLsizei instanceCount) {
+    if (!count || !instanceCount || !sVertexArray) {
+        return;
+    }
+    bindInstances(instanceBuffer, firstInstance, nullptr);
+    for (GLsizei Draw = 0; Draw < count; ++Draw) {
+        glDrawArraysInstanced(mode, ranges[Draw].BaseVertex, ranges[Draw].Count, instanceCount);
+    }
+    glBindVertexArray(0);
+    CountDraws(static_cast<unsigned>(count), 1);
+}
+
+void
+GeometryArena::MultiDrawIndirect(GLenum mode, unsigned commandBuffer, unsigned countBuffer, GLsizei maxCount) {
+    glBindVertexArray(sVertexArray);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if (countBuffer) {
+        glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+        if (GLEW_VERSION_4_6) {
+            glMultiDrawElementsIndirectCount(mode, GL_UNSIGNED_INT, nullptr, 0, maxCount, 0);
+        }
+        else {
+            glMultiDrawElementsIndirectCountARB(mode, GL_UNSIGNED_INT, nullptr, 0, maxCount, 0);
+        }
+        glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    }
+    else {
+        glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, nullptr, maxCount, 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+    CountDraws(1, 1);
+}
+
+void
+GeometryArena::CountDraws(unsigned drawCalls, unsigned vertexArrayBinds) {
+    sStats.DrawCalls += drawCalls;
+    sStats.VertexArrayBinds += vertexArrayBinds;
+}
+
+RenderStats
+GeometryArena::GetStats() {
+    return sStats;
+}
+
+void
+GeometryArena::ResetStats() {
+    sStats = { 0, 0 };
+}
+
+unsigned
+GeometryArena::GetVertexBuffer() {
+    return sVertexBuffer;
+}
+
+size_t
+GeometryArena::GetUsedBytes() {
+    return static_cast<size_t>(sVertices.GetUsed()) * ARENA_VERTEX_FLOATS * sizeof(float)
+        + static_cast<size_t>(sIndices.GetUsed()) * sizeof(unsigned);
+}
+
+size_t
+GeometryArena::GetCapacityBytes() {
+    return static_cast<size_t>(sVertices.GetCapacity()) * ARENA_VERTEX_FLOATS * sizeof(float)
+        + static_cast<size_t>(sIndices.GetCapacity()) * sizeof(unsigned);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <GL/glew.h>
+
+// Floats per vertex: position, normal and texture coordinates
+#define ARENA_VERTEX_FLOATS 8
+#define ARENA_INITIAL_VERTICES (1 << 16)
+#define ARENA_INITIAL_INDICES (1 << 18)
+
+// Range of elements in one of the arena buffers
+struct ArenaAllocation {
+    unsigned Offset = 0;
+    unsigned Count = 0;
+};
+
+// One draw of a multi-draw, offsets are in indices and vertices. Draws without
+// indices start at the base vertex.
+struct DrawRange {
+    GLsizei Count;
+    unsigned FirstIndex;
+    GLint BaseVertex;
+};
+
+struct RenderStats {
+    unsigned DrawCalls;
+    unsigned VertexArrayBinds;
+};
+
+// First-fit allocator over a range of elements. Freed ranges are merged with
+// their neighbours and reused by later allocations.
+class RangeAllocator {
+
+private:
+    // Free ranges by offset
+    std::map<unsigned, unsigned> mFree;
+    unsigned mCapacity = 0;
+    unsigned mUsed = 0;
+
+public:
+    static const unsigned INVALID_OFFSET = 0xFFFFFFFF;
+
+    unsigned Allocate(unsigned count);
+    void Free(unsigned offset, unsigned count);
+    // Appends the new elements to the free list
+    void Grow(unsigned capacity);
+    unsigned GetCapacity() const;
+    unsigned GetUsed() const;
+};
+
+// Vertex and index buffers shared by every mesh, with one vertex array
+// describing both. Meshes get ranges of them instead of their own buffers, so
+// a whole model draws with one vertex array bind and one multi-draw. Indices
+// stay relative to the mesh and are offset by the base vertex of the draw.
+// Buffers grow by doubling when a range does not fit. Only used from the GL
+// thread.
+class GeometryArena {
+
+private:
+    static unsigned sVertexArray;
+    // Same buffers plus a per-instance model matrix at locations 3 to 6
+    static unsigned sInstancedVertexArray;
+    static unsigned sVertexBuffer;
+    static unsigned sIndexBuffer;
+    static RangeAllocator sVertices;
+    static RangeAllocator sIndices;
+    static RenderStats sStats;
+
+    static void create();
+    static void setupVertexArray(unsigned vertexArray);
+    // Binds the instanced vertex array reading matrices from firstInstance on
+    static void bindInstances(unsigned instanceBuffer, unsigned firstInstance, const float* localTransform);
+    static void grow(unsigned& buffer, size_t usedBytes, size_t capacityBytes);
+    static unsigned allocate(RangeAllocator& allocator, unsigned& buffer, size_t elementBytes, unsigned count);
+
+public:
+    static ArenaAllocation AllocateVertices(const float* vertices, unsigned count);
+    static ArenaAllocation AllocateIndices(const unsigned* indices, unsigned count);
+    // Range whose contents are written on the GPU
+    static ArenaAllocation ReserveVertices(unsigned count);
+    static void FreeVertices(ArenaAllocation& allocation);
+    static void FreeIndices(ArenaAllocation& allocation);
+    static void ReadVertices(const ArenaAllocation& allocation, float* vertices);
+    static void ReadIndices(const ArenaAllocation& allocation, unsigned* indices);
+    // Binds the shared vertex array and draws all ranges with one call
+    static void MultiDraw(GLenum mode, const DrawRange* ranges, GLsizei count);
+    static void MultiDrawArrays(GLenum mode, const DrawRange* ranges, GLsizei count);
+    // One instanced draw per range, instanceBuffer holds a mat4 per instance
+    // and the draws read instanceCount of them from firstInstance on. A local
+    // transform, 16 floats by column, is applied inside every instance.
+    static void DrawInstanced(GLenum mode, const DrawRange* ranges, GLsizei count, unsigned instanceBuffer,
+        unsigned firstInstance, GLsizei instanceCount, const float* localTransform = nullptr);
+    // Same for ranges of vertices drawn without indices
+    static void DrawArraysInstanced(GLenum mode, const DrawRange* ranges, GLsizei count, unsigned instanceBuffer,
+        unsigned firstInstance, GLsizei instanceCount);
+    // Draws the commands in a buffer written on the GPU. With a count buffer
+    // the number of draws is read from it, up to maxCount.
+    static void MultiDrawIndirect(GLenum mode, unsigned commandBuffer, unsigned countBuffer, GLsizei maxCount);
+    // For draws made outside the arena
+    static void CountDraws(unsigned drawCalls, unsigned vertexArrayBinds);
+    static RenderStats GetStats();
+    static void ResetStats();
+    // Changes when the buffer grows, do not keep it across allocations
+    static unsigned GetVertexBuffer();
+    static size_t GetUsedBytes();
+    static size_t GetCapacityBytes();
+};
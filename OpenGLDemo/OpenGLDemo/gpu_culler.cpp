@@ -0,0 +1,116 @@
+#include "gpu_culler.hpp"
+
+#include <iostream>
+#include "shader.hpp"
+
+#define GPU_CULL_LOCAL_SIZE 64
+
+unsigned GpuCuller::sProgram = 0;
+bool GpuCuller::sCreated = false;
+
+GpuCuller::~GpuCuller() {
+    release();
+}
+
+bool
+GpuCuller::createProgram() {
+    sCreated = true;
+    sProgram = Shader::CreateComputeProgram(GPU_CULL_SHADER_PATH);
+    if (!sProgram) {
+        std::cerr << "GPU culling is unavailable, meshes are culled on the CPU" << std::endl;
+    }
+    return sProgram != 0;
+}
+
+bool
+GpuCuller::IsAvailable() {
+    // Compute shaders, storage buffers and indirect multi-draws all came with 4.3
+    return GLEW_VERSION_4_3 != 0;
+}
+
+bool
+GpuCuller::hasDrawCount() {
+    return GLEW_VERSION_4_6 || GLEW_ARB_indirect_parameters;
+}
+
+bool
+GpuCuller::IsCompacting() {
+    return hasDrawCount();
+}
+
+void
+GpuCuller::release() {
+    glDeleteBuffers(1, &mRecordBuffer);
+    glDeleteBuffers(1, &mCommandBuffer);
+    glDeleteBuffers(1, &mCountBuffer);
+    mRecordBuffer = mCommandBuffer = mCountBuffer = 0;
+    mRecordCount = 0;
+}
+
+void
+GpuCuller::Build(const std::vector<GpuCullRecord>& records) {
+    release();
+    mRecordCount = static_cast<unsigned>(records.size());
+    if (!mRecordCount) {
+        return;
+    }
+    glGenBuffers(1, &mRecordBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRecordBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(GpuCullRecord), records.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &mCommandBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCommandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &mCountBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void
+GpuCuller::UpdateRecord(unsigned index, const GpuCullRecord& record) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRecordBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, index * sizeof(GpuCullRecord), sizeof(GpuCullRecord), &record);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+bool
+GpuCuller::Cull(const Frustum& frustum, bool smooth) {
+    if (!sCreated) {
+        createProgram();
+    }
+    if (!sProgram || !mRecordCount) {
+        return false;
+    }
+    const GLuint Zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &Zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mRecordBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mCommandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mCountBuffer);
+
+    // Runs from inside draw passes, after the caller has bound its shader
+    const unsigned PreviousProgram = Shader::GetBoundProgram();
+    Shader::UseProgram(sProgram);
+    glUniform4fv(glGetUniformLocation(sProgram, "uPlanes"), 6, &frustum.GetPlane(0).x);
+    glUniform1ui(glGetUniformLocation(sProgram, "uRecordCount"), mRecordCount);
+    glUniform1i(glGetUniformLocation(sProgram, "uSmooth"), smooth);
+    glUniform1i(glGetUniformLocation(sProgram, "uCompact"), hasDrawCount());
+    glDispatchCompute((mRecordCount + GPU_CULL_LOCAL_SIZE - 1) / GPU_CULL_LOCAL_SIZE, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    Shader::UseProgram(PreviousProgram);
+    return true;
+}
+
+void
+GpuCuller::Draw(GLenum mode) const {
+    if (!mRecordCount) {
+        return;
+    }
+    GeometryArena::MultiDrawIndirect(mode, mCommandBuffer, hasDrawCount() ? mCountBuffer : 0, static_cast<GLsizei>(mRecordCount));
+}
+
+unsigned
+GpuCuller::GetRecordCount() const {
+    return mRecordCount;
+}
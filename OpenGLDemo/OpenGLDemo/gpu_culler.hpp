@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "frustum.hpp"
+#include "geometry_arena.hpp"
+
+#define GPU_CULL_SHADER_PATH "shaders/cull_draws.comp"
+
+// What the culling shader needs of a mesh, laid out as the std430 struct in
+// the shader
+struct GpuCullRecord {
+    glm::vec4 BoxMin;
+    glm::vec4 BoxMax;
+    GLuint Count;
+    GLuint FirstIndex;
+    GLint FlatBaseVertex;
+    GLint SmoothBaseVertex;
+};
+
+// Layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand {
+    GLuint Count;
+    GLuint InstanceCount;
+    GLuint FirstIndex;
+    GLint BaseVertex;
+    GLuint BaseInstance;
+};
+
+// Work of the passes culled on the GPU in one frame. Visible counts stay on
+// the GPU, reading them back would stall the pipeline.
+struct GpuCullStats {
+    unsigned Dispatches;
+    unsigned MeshesPerDispatch;
+    // Passes that went back to the CPU lists because the shader was not usable
+    unsigned Fallbacks;
+};
+
+// GPU-driven submission for one model. Mesh bounds and draw ranges live in a
+// storage buffer, a compute shader tests them against the frustum and writes
+// the indirect commands of the visible ones, and the whole pass is one
+// indirect multi-draw, so the CPU does the same work for any number of meshes.
+// With GL 4.6 or ARB_indirect_parameters the commands are compacted and the
+// draw count comes from a buffer. With plain GL 4.3 every mesh keeps its
+// command and culled ones get no instances.
+class GpuCuller {
+
+private:
+    static unsigned sProgram;
+    static bool sCreated;
+
+    unsigned mRecordBuffer = 0;
+    unsigned mCommandBuffer = 0;
+    unsigned mCountBuffer = 0;
+    unsigned mRecordCount = 0;
+
+    static bool createProgram();
+    static bool hasDrawCount();
+    void release();
+
+public:
+    GpuCuller() = default;
+    ~GpuCuller();
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller& operator=(const GpuCuller&) = delete;
+
+    static bool IsAvailable();
+    // Whether culled draws are compacted away or only get no instances
+    static bool IsCompacting();
+    void Build(const std::vector<GpuCullRecord>& records);
+    void UpdateRecord(unsigned index, const GpuCullRecord& record);
+    // Writes the commands of the meshes inside the frustum, false when the
+    // shader is not usable
+    bool Cull(const Frustum& frustum, bool smooth);
+    void Draw(GLenum mode) const;
+    unsigned GetRecordCount() const;
+};
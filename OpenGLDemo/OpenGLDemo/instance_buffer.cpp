@@ -0,0 +1,61 @@
+#include "instance_buffer.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <GL/glew.h>
+
+InstanceBuffer::~InstanceBuffer() {
+    Release();
+}
+
+InstanceBuffer::InstanceBuffer(InstanceBuffer&& other) noexcept
+    : mBuffer(std::exchange(other.mBuffer, 0)),
+      mCapacity(std::exchange(other.mCapacity, 0)),
+      mCount(std::exchange(other.mCount, 0)) {
+}
+
+InstanceBuffer&
+InstanceBuffer::operator=(InstanceBuffer&& other) noexcept {
+    if (this != &other) {
+        Release();
+        mBuffer = std::exchange(other.mBuffer, 0);
+        mCapacity = std::exchange(other.mCapacity, 0);
+        mCount = std::exchange(other.mCount, 0);
+    }
+    return *this;
+}
+
+void
+InstanceBuffer::Upload(const std::vector<glm::mat4>& transforms) {
+    if (!mBuffer) {
+        glGenBuffers(1, &mBuffer);
+    }
+    mCount = static_cast<unsigned>(transforms.size());
+    mCapacity = std::max(mCapacity, mCount);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, mCapacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+    if (mCount) {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, mCount * sizeof(glm::mat4), transforms.data());
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void
+InstanceBuffer::Release() {
+    if (mBuffer) {
+        glDeleteBuffers(1, &mBuffer);
+    }
+    mBuffer = 0;
+    mCapacity = 0;
+    mCount = 0;
+}
+
+unsigned
+InstanceBuffer::GetBuffer() const {
+    return mBuffer;
+}
+
+unsigned
+InstanceBuffer::GetCount() const {
+    return mCount;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Model matrices of instances in a vertex buffer, read by instanced draws as
+// a per-instance attribute. Uploads orphan the previous contents so the driver
+// does not wait on draws still reading them.
+class InstanceBuffer {
+
+private:
+    unsigned mBuffer = 0;
+    unsigned mCapacity = 0;
+    unsigned mCount = 0;
+
+public:
+    InstanceBuffer() = default;
+    ~InstanceBuffer();
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+    InstanceBuffer(InstanceBuffer&& other) noexcept;
+    InstanceBuffer& operator=(InstanceBuffer&& other) noexcept;
+
+    // Has to run on the GL thread
+    void Upload(const std::vector<glm::mat4>& transforms);
+    // Deletes the buffer while the context still exists, the next Upload makes a new one
+    void Release();
+    unsigned GetBuffer() const;
+    unsigned GetCount() const;
+};
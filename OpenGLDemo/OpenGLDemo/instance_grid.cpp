@@ -0,0 +1,66 @@
+#include "instance_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+void
+InstanceGrid::Build(unsigned count, const BoundingBox& modelBox, const glm::mat4& modelMatrix) {
+    count = std::min(std::max(count, 1u), static_cast<unsigned>(INSTANCE_GRID_MAX_COUNT));
+    // World box of the original, every other instance is a translated copy
+    BoundingBox WorldBox;
+    for (unsigned CornerIdx = 0; CornerIdx < 8; ++CornerIdx) {
+        const glm::vec3 Corner((CornerIdx & 1) ? modelBox.Max.x : modelBox.Min.x, (CornerIdx & 2) ? modelBox.Max.y : modelBox.Min.y,
+            (CornerIdx & 4) ? modelBox.Max.z : modelBox.Min.z);
+        const glm::vec3 World = glm::vec3(modelMatrix * glm::vec4(Corner, 1.0f));
+        WorldBox.Min = CornerIdx ? glm::min(WorldBox.Min, World) : World;
+        WorldBox.Max = CornerIdx ? glm::max(WorldBox.Max, World) : World;
+    }
+    const glm::vec3 Size = WorldBox.Max - WorldBox.Min;
+    const float Spacing = INSTANCE_GRID_SPACING * std::max(std::max(Size.x, Size.z), 1e-3f);
+    const unsigned Columns = static_cast<unsigned>(std::ceil(std::sqrt(static_cast<float>(count))));
+
+    mTransforms.clear();
+    mTransforms.reserve(count);
+    std::vector<BoundingBox> Boxes;
+    Boxes.reserve(count);
+    for (unsigned Instance = 0; Instance < count; ++Instance) {
+        const glm::vec3 Offset(Spacing * (Instance % Columns), 0.0f, Spacing * (Instance / Columns));
+        mTransforms.push_back(glm::translate(glm::mat4(1.0f), Offset) * modelMatrix);
+        Boxes.push_back({ WorldBox.Min + Offset, WorldBox.Max + Offset });
+    }
+    mCuller.Build(Boxes);
+    mVisibleTransforms.clear();
+}
+
+void
+InstanceGrid::Cull(const glm::mat4& viewProjection) {
+    mCuller.Cull(Frustum(viewProjection), mVisible);
+    mVisibleTransforms.clear();
+    for (size_t Instance = 0; Instance < mTransforms.size(); ++Instance) {
+        if (mVisible[Instance]) {
+            mVisibleTransforms.push_back(mTransforms[Instance]);
+        }
+    }
+    mBuffer.Upload(mVisibleTransforms);
+}
+
+void
+InstanceGrid::Release() {
+    mBuffer.Release();
+}
+
+unsigned
+InstanceGrid::GetCount() const {
+    return static_cast<unsigned>(mTransforms.size());
+}
+
+unsigned
+InstanceGrid::GetVisibleCount() const {
+    return mBuffer.GetCount();
+}
+
+unsigned
+InstanceGrid::GetBuffer() const {
+    return mBuffer.GetBuffer();
+}
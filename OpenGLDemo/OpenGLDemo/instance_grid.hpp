@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "frustum.hpp"
+#include "instance_buffer.hpp"
+
+// Instances per side grow with the square root of the count
+#define INSTANCE_GRID_SPACING 1.25f
+#define INSTANCE_GRID_MAX_COUNT 4096
+
+// Copies of a model laid out on a square grid in the XZ plane, starting with
+// the original at the origin. Every frame the instances inside the frustum are
+// culled eight at a time and their transforms compacted into a vertex buffer,
+// which instanced draws read as a per-instance attribute.
+class InstanceGrid {
+
+private:
+    std::vector<glm::mat4> mTransforms;
+    FrustumCuller mCuller;
+    std::vector<unsigned char> mVisible;
+    std::vector<glm::mat4> mVisibleTransforms;
+    InstanceBuffer mBuffer;
+
+public:
+    // Box of the model in model space, spaced apart by its size after the model matrix
+    void Build(unsigned count, const BoundingBox& modelBox, const glm::mat4& modelMatrix);
+    // Uploads the transforms of the visible instances, has to run on the GL thread
+    void Cull(const glm::mat4& viewProjection);
+    // Frees the instance buffer, before the context is destroyed
+    void Release();
+    unsigned GetCount() const;
+    unsigned GetVisibleCount() const;
+    unsigned GetBuffer() const;
+};
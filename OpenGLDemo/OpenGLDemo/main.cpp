@@ -5,13 +5,27 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <thread>
+#include <cstring>
 #include "shader.hpp"
 #include "camera.hpp"
 #include "model.hpp"
 #include "texture.hpp"
+#include "mesh_cache.hpp"
+#include "alloc_counter.hpp"
+#include "uniform_buffer.hpp"
+#include "smooth_normals.hpp"
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw_gl3.h"
 
+static constexpr UniformName U_COLOR("uColor");
+static constexpr UniformName U_AMBIENT_MAP("uAmbientMap");
+static constexpr UniformName U_DIFFUSE_MAP("uDiffuseMap");
+static constexpr UniformName U_SPECULAR_MAP("uSpecularMap");
+static constexpr UniformName U_WIRE_COLOR("uWireColor");
+static constexpr UniformName U_WIRE_WIDTH("uWireWidth");
+static constexpr UniformName U_VIEWPORT_SIZE("uViewportSize");
+static constexpr UniformName U_NORMAL_LENGTH("uNormalLength");
+
 struct input
 {
 	bool move_left;
@@ -26,6 +40,15 @@ struct input
 	bool go_down;
 };
 
+// Bits of the shader permutation keys, in the order of their keywords
+enum EShaderFeature
+{
+	SHADER_FLASHLIGHT = 1 << 0,
+	SHADER_TEXTURE = 1 << 1,
+	SHADER_TEXTURE_ARRAY = 1 << 2,
+	SHADER_INSTANCING = 1 << 3,
+};
+
 enum shading_mode
 {
 	flat,
@@ -153,53 +176,80 @@ void handle_key_input(GLFWwindow* window, engine_state* state)
 	}
 }
 
-void mode_averaged_normals(const Shader* current_shader, const std::vector<float>& averaged_normal_vertices, const unsigned averaged_normal_lines_vao, const std::vector<float>& cube_vertices, const glm::vec3 color)
+void mode_render_vertices(Model& model, const Shader* current_shader, const glm::vec3 color, const float point_size)
 {
-	current_shader->SetUniform3f("uColor", color);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glBindVertexArray(averaged_normal_lines_vao);
-	glDrawArrays(GL_LINES, 0, averaged_normal_vertices.size() / 3);
-	glBindVertexArray(0);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	current_shader->Bind();
+	glPointSize(point_size);
+	current_shader->SetUniform3f(U_COLOR, color);
+	model.RenderVertices();
 }
 
-void mode_render_vertices(Model model, const Shader* current_shader, const glm::vec3 color, const float point_size)
+void mode_render_triangles(Model& model, const Shader* current_shader, const glm::vec3 color)
 {
-	glPointSize(point_size);
-	current_shader->SetUniform3f("uColor", color);
-	model.RenderVertices();
+	current_shader->Bind();
+	current_shader->SetUniform3f(U_COLOR, color);
+	model.RenderEdges();
 }
 
-void mode_render_triangles(Model model, const Shader* current_shader, const glm::vec3 color)
+void mode_render_filled_triangles(Model& model, const Shader* current_shader, const glm::vec3 color)
 {
-	current_shader->SetUniform3f("uColor", color);
-	model.RenderTriangles();
+	current_shader->Bind();
+	current_shader->SetUniform3f(U_COLOR, color);
+	model.RenderFilledTriangles();
 }
 
-void mode_render_filled_triangles(Model model, const Shader* current_shader, const glm::vec3 color)
+// Filled triangles with their edges drawn in the same pass
+void mode_render_wireframe_overlay(Model& model, const Shader* current_shader, const glm::vec3 color, const glm::vec3 wire_color, const float wire_width, const glm::vec2 viewport_size)
 {
-	current_shader->SetUniform3f("uColor", color);
+	current_shader->Bind();
+	current_shader->SetUniform3f(U_COLOR, color);
+	current_shader->SetUniform3f(U_WIRE_COLOR, wire_color);
+	current_shader->SetUniform1f(U_WIRE_WIDTH, wire_width);
+	current_shader->SetUniform2f(U_VIEWPORT_SIZE, viewport_size);
 	model.RenderFilledTriangles();
 }
 
-void mode_render_normals(Model model, const Shader* current_shader, glm::vec3 all_normals_color)
+// Normal lines are expanded from the vertices by the geometry shader
+void mode_render_normals(Model& model, const Shader* current_shader, glm::vec3 all_normals_color, const float normal_length)
 {
-	current_shader->SetUniform3f("uColor", glm::vec3(all_normals_color));
+	current_shader->Bind();
+	current_shader->SetUniform3f(U_COLOR, glm::vec3(all_normals_color));
+	current_shader->SetUniform1f(U_NORMAL_LENGTH, normal_length);
 	model.RenderNormals();
 }
 
-void mode_averaged_normals(Model model, const Shader* current_shader, const glm::vec3 averaged_normals_color)
+void mode_averaged_normals(Model& model, const Shader* current_shader, const glm::vec3 averaged_normals_color, const float normal_length)
 {
-	current_shader->SetUniform3f("uColor", averaged_normals_color);
+	current_shader->Bind();
+	current_shader->SetUniform3f(U_COLOR, averaged_normals_color);
+	current_shader->SetUniform1f(U_NORMAL_LENGTH, normal_length);
 	model.RenderAveragedNormals();
 }
 
-void mode_render_with_texture(Model model, unsigned test_texture, unsigned test_specular_texture, Shader* current_shader)
+// Shading modes draw the model once, or every visible instance of the grid
+void mode_render_shaded(Model& model, const Shader* current_shader, const InstanceGrid* grid, const bool smooth)
+{
+	current_shader->Bind();
+	if (grid)
+	{
+		model.RenderInstanced(*grid, smooth);
+	}
+	else if (smooth)
+	{
+		model.RenderSmooth();
+	}
+	else
+	{
+		model.RenderFlat();
+	}
+}
+
+void mode_render_with_texture(Model& model, unsigned test_texture, unsigned test_specular_texture, Shader* current_shader)
 {
-	glUseProgram(current_shader->GetId());
-	current_shader->SetUniform1i("uMaterial.Ka", 0);
-	current_shader->SetUniform1i("uMaterial.Kd", 0);
-	current_shader->SetUniform1i("uMaterial.Ks", 1);
+	current_shader->Bind();
+	current_shader->SetUniform1i(U_AMBIENT_MAP, 0);
+	current_shader->SetUniform1i(U_DIFFUSE_MAP, 0);
+	current_shader->SetUniform1i(U_SPECULAR_MAP, 1);
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, test_texture);
 	glActiveTexture(GL_TEXTURE1);
@@ -207,8 +257,35 @@ void mode_render_with_texture(Model model, unsigned test_texture, unsigned test_
 	model.RenderSmooth();
 }
 
-int main()
+// Cooks the given images into the texture cache without opening a window
+static int cook_textures(int count, char** paths)
 {
+	int failed = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const std::string cache_path = TextureCooker::CachePath(paths[i]);
+		LoadedImage image = Texture::LoadImageData(paths[i], true);
+		if (cache_path.empty() || image.Compressed.Levels.empty())
+		{
+			std::cerr << "Failed to cook texture: " << paths[i] << std::endl;
+			++failed;
+			continue;
+		}
+		const CompressedLevel& top = image.Compressed.Levels[0];
+		std::cout << paths[i] << " -> " << cache_path << " (" << top.Width << "x" << top.Height << ", "
+			<< image.Compressed.Levels.size() << " levels, " << TextureCooker::GetByteSize(image.Compressed) << " bytes, "
+			<< image.LoadMs << " ms)" << std::endl;
+	}
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && std::strcmp(argv[1], "--cook") == 0)
+	{
+		return cook_textures(argc - 2, argv + 2);
+	}
+
 	GLFWwindow* window = nullptr;
 	if (!glfwInit())
 	{
@@ -252,7 +329,7 @@ int main()
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
-	Model model("res/moto_simple_1.obj");
+	Model model("res/moto_simple_1.obj", RESIDENCY_RELEASE);
 	if (!model.Load())
 	{
 		std::cerr << "Failed to load model\n";
@@ -261,16 +338,68 @@ int main()
 	}
 
 	Shader color_only("shaders/phong.vert", "shaders/color.frag");
-	Shader flat_shader_material("shaders/flat.vert", "shaders/flat.frag");
-	Shader gouraud_shader_material("shaders/gouraud.vert", "shaders/gouraud.frag");
-	Shader phong_shader_material("shaders/phong.vert", "shaders/phong_material.frag");
-	Shader phong_shader_material_texture("shaders/phong.vert", "shaders/phong_material_texture.frag");
-	glUseProgram(phong_shader_material.GetId());
+	Shader edge_lines("shaders/phong.vert", "shaders/edge_lines.geom", "shaders/color.frag");
+	Shader normal_lines("shaders/normal_lines.vert", "shaders/normal_lines.geom", "shaders/color.frag");
+	Shader wireframe_overlay("shaders/phong.vert", "shaders/wireframe.geom", "shaders/wireframe.frag");
+	// Meshes placed more than once draw their further placements with these after each pass
+	const std::vector<std::string> instancing_keywords = { "USE_INSTANCING" };
+	Shader color_only_instanced("shaders/phong.vert", "shaders/color.frag", instancing_keywords);
+	Shader edge_lines_instanced("shaders/phong.vert", "shaders/edge_lines.geom", "shaders/color.frag", instancing_keywords);
+	Shader normal_lines_instanced("shaders/normal_lines.vert", "shaders/normal_lines.geom", "shaders/color.frag", instancing_keywords);
+	Shader wireframe_overlay_instanced("shaders/phong.vert", "shaders/wireframe.geom", "shaders/wireframe.frag", instancing_keywords);
+	// Every material shader takes all keywords so the feature bits mean the same for each
+	const std::vector<std::string> shader_keywords = { "FLASHLIGHT", "USE_TEXTURE", "USE_TEXTURE_ARRAY", "USE_INSTANCING" };
+	ShaderPermutations flat_shader_material("shaders/flat.vert", "shaders/flat.frag", shader_keywords);
+	ShaderPermutations gouraud_shader_material("shaders/gouraud.vert", "shaders/gouraud.frag", shader_keywords);
+	ShaderPermutations phong_shader_material("shaders/phong.vert", "shaders/phong_material.frag", shader_keywords);
+	// Start on the variants used with the flashlight off, the others are built when first needed
+	flat_shader_material.Get(0);
+	gouraud_shader_material.Get(0);
+	phong_shader_material.Get(0);
+	phong_shader_material.Get(model.HasTextures() ? SHADER_TEXTURE_ARRAY : SHADER_TEXTURE);
+	const ShaderStartupReport shader_report = Shader::GetStartupReport();
+	std::cout << "Shader programs: " << shader_report.Cached << " loaded from cache in " << shader_report.LoadMs << " ms (saved "
+		<< shader_report.SavedMs << " ms of compilation), " << shader_report.Pending << " compiling until first use" << std::endl;
 
-	unsigned test_texture = Texture::LoadImageToTexture("res/test.png");
-	unsigned test_specular_texture = Texture::LoadImageToTexture("res/test_spec.png");
-
-	Shader* current_shader = &phong_shader_material;
+	glm::mat4 model_matrix(1.0f);
+	int instance_count = 1;
+	InstanceGrid instance_grid;
+	instance_grid.Build(instance_count, model.GetBoundingBox(), model_matrix);
+
+	UniformBuffer frame_block(FRAME_BLOCK, sizeof(FrameData));
+	UniformBuffer light_block(LIGHT_BLOCK, sizeof(LightData));
+	UniformBuffer material_block(MATERIAL_BLOCK, sizeof(MaterialData));
+	// Zeroed so that the padding compares equal between frames
+	FrameData frame_data;
+	LightData light_data;
+	MaterialData material_data;
+	std::memset(&frame_data, 0, sizeof(frame_data));
+	std::memset(&light_data, 0, sizeof(light_data));
+	std::memset(&material_data, 0, sizeof(material_data));
+
+	light_data.SunLight.Position = glm::vec3(0, 0, -10);
+	light_data.SunLight.Kc = 0.001f;
+	light_data.SunLight.Kq = 0.01f;
+	light_data.SunLight.Kl = 0.11f;
+	light_data.SunLight.Ka = glm::vec3(0.5);
+	light_data.SunLight.Kd = glm::vec3(0.5);
+	light_data.SunLight.Ks = glm::vec3(1.0);
+
+	light_data.FlashLight.Kc = 0.6f;
+	light_data.FlashLight.Kl = 0.0002f;
+	light_data.FlashLight.Kq = 0.0002f;
+	light_data.FlashLight.InnerCutOff = glm::cos(glm::radians(1.0f));
+	light_data.FlashLight.OuterCutOff = glm::cos(glm::radians(30.0f));
+
+	light_data.DirLight.Direction = glm::vec3(0, -0.1, 0);
+	light_data.DirLight.Ka = glm::vec3(0.6);
+	light_data.DirLight.Kd = glm::vec3(0.6);
+	light_data.DirLight.Ks = glm::vec3(1);
+
+	unsigned test_texture = TextureCache::Acquire("res/test.png");
+	unsigned test_specular_texture = TextureCache::Acquire("res/test_spec.png");
+
+	Shader* current_shader = &phong_shader_material.Get(0);
 	bool flash_light = false;
 	bool show_gui = true;
 	bool is_f_key_pressed = false;
@@ -281,8 +410,16 @@ int main()
 	float background_color = 0.0f;
 	float filled_color = 0.3f;
 	float points_and_lines_color = 1.0f;
+	float wire_width = 1.0f;
+	float normal_length = 0.2f;
 	float shininess = 0.75;
-	glm::mat4 model_matrix(1.0f);
+	size_t geometry_allocations = 0;
+	UniformStats uniform_stats = { 0, 0 };
+	int residency_policy = model.GetResidencyPolicy();
+	unsigned uniform_block_updates = 0;
+	unsigned texture_array_binds = 0;
+	RenderStats render_stats = { 0, 0 };
+	float texture_upload_budget = static_cast<float>(TextureCache::GetUploadBudget());
 	glm::vec3 material_ka(0.5);
 	glm::vec3 material_kd(0.5);
 	glm::vec3 material_ks(0.5);
@@ -297,43 +434,33 @@ int main()
 	while (!glfwWindowShouldClose(window)) 
 	{
 		start_time = glfwGetTime();
+		uniform_stats = Shader::GetUniformStats();
+		Shader::ResetUniformStats();
+		uniform_block_updates = UniformBuffer::GetUpdateCount();
+		UniformBuffer::ResetUpdateCount();
+		texture_array_binds = TextureAtlas::GetBindCount();
+		TextureAtlas::ResetBindCount();
+		render_stats = GeometryArena::GetStats();
+		GeometryArena::ResetStats();
 		glfwPollEvents();
+		TextureCache::Update();
+		model.Update();
 		handle_key_input(window, &state);
 		handle_input(&state);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glUseProgram(current_shader->GetId());
-		current_shader->SetProjection(glm::perspective(70.0f, static_cast<float>(window_width) / static_cast<float>(window_height), 0.1f, 10000.0f));
-		current_shader->SetView(glm::lookAt(fps_camera.GetPosition(), fps_camera.GetTarget(), fps_camera.GetUp()));
-		current_shader->SetUniform3f("uViewPos", fps_camera.GetPosition());
-		current_shader->SetModel(model_matrix);
-
-		glm::vec3 point_light_position_sun(0, 0, -10);
-		current_shader->SetUniform3f("uSunLight.Position", point_light_position_sun);
-		current_shader->SetUniform1f("uSunLight.Kc", 0.001);
-		current_shader->SetUniform1f("uSunLight.Kq", 0.01);
-		current_shader->SetUniform1f("uSunLight.Kl", 0.11);
-		current_shader->SetUniform3f("uSunLight.Ka", glm::vec3(0.5));
-		current_shader->SetUniform3f("uSunLight.Kd", glm::vec3(0.5));
-		current_shader->SetUniform3f("uSunLight.Ks", glm::vec3(1.0));
-
-		current_shader->SetUniform3f("uFlashLight.Position", glm::vec3(fps_camera.GetPosition()));
-		current_shader->SetUniform3f("uFlashLight.Direction", glm::vec3(0));
-		current_shader->SetUniform3f("uFlashLight.Ka", glm::vec3(0));
-		current_shader->SetUniform1f("uFlashLight.Kc", 0.6f);
-		current_shader->SetUniform1f("uFlashLight.Kl", 0.0002f);
-		current_shader->SetUniform1f("uFlashLight.Kq", 0.0002f);
-		current_shader->SetUniform1f("uFlashLight.InnerCutOff", glm::cos(glm::radians(1.0f)));
-		current_shader->SetUniform1f("uFlashLight.OuterCutOff", glm::cos(glm::radians(30.0f)));
-
-		current_shader->SetUniform3f("uMaterial.Ka", material_ka); // *** Check what is it for
-		current_shader->SetUniform3f("uMaterial.Kd", material_kd);
-		current_shader->SetUniform3f("uMaterial.Ks", material_ks);
-		current_shader->SetUniform1f("uMaterial.Shininess", shininess * 128);
-
-		current_shader->SetUniform3f("uDirLight.Direction", glm::vec3(0, -0.1, 0));
-		current_shader->SetUniform3f("uDirLight.Ka", glm::vec3(0.6));
-		current_shader->SetUniform3f("uDirLight.Kd", glm::vec3(0.6));
-		current_shader->SetUniform3f("uDirLight.Ks", glm::vec3(1));
+		frame_data.Projection = glm::perspective(70.0f, static_cast<float>(window_width) / static_cast<float>(window_height), 0.1f, 10000.0f);
+		frame_data.View = glm::lookAt(fps_camera.GetPosition(), fps_camera.GetTarget(), fps_camera.GetUp());
+		frame_data.ViewPos = fps_camera.GetPosition();
+		frame_block.Set(frame_data);
+		// Culling is part of drawing the geometry, it is counted with the passes
+		const size_t allocations_before_geometry = AllocCounter::GetCount();
+		model.Cull(frame_data.Projection * frame_data.View * model_matrix);
+
+		material_data.Ka = material_ka; // *** Check what is it for
+		material_data.Kd = material_kd;
+		material_data.Ks = material_ks;
+		material_data.Shininess = shininess * 128;
+		material_block.Set(material_data);
 
 		if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
 		{
@@ -373,81 +500,174 @@ int main()
 			state.enable_mouse_callback = true;
 		}
 
+		// A disabled flashlight keeps its last placement so camera movement does not dirty the lights
 		if (flash_light)
 		{
-			glm::vec3 pos = fps_camera.GetTarget() - fps_camera.GetPosition();
-			current_shader->SetUniform3f("uFlashLight.Position", glm::vec3(fps_camera.GetPosition()));
-			current_shader->SetUniform3f("uFlashLight.Direction", glm::vec3(pos.x, pos.y, pos.z));
-			current_shader->SetUniform3f("uFlashLight.Kd", glm::vec3(1));
-			current_shader->SetUniform3f("uFlashLight.Ks", glm::vec3(1));
+			light_data.FlashLight.Position = fps_camera.GetPosition();
+			light_data.FlashLight.Direction = fps_camera.GetTarget() - fps_camera.GetPosition();
+			light_data.FlashLight.Kd = glm::vec3(1);
+			light_data.FlashLight.Ks = glm::vec3(1);
 		}
 		else
 		{
-			current_shader->SetUniform3f("uFlashLight.Kd", glm::vec3(0));
-			current_shader->SetUniform3f("uFlashLight.Ks", glm::vec3(0));
+			light_data.FlashLight.Kd = glm::vec3(0);
+			light_data.FlashLight.Ks = glm::vec3(0);
 		}
+		light_block.Set(light_data);
+		// Without the flashlight the variants that skip it are the cheapest
+		const unsigned light_features = flash_light ? SHADER_FLASHLIGHT : 0;
+
+		int framebuffer_width = 0;
+		int framebuffer_height = 0;
+		glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+		const glm::vec2 viewport_size(framebuffer_width, framebuffer_height);
 
 		switch (state.mode)
 		{
 		case 1:
 			current_shader = &color_only;
+			current_shader->SetModel(model_matrix);
 			mode_render_vertices(model, current_shader, glm::vec3(points_and_lines_color), 2);
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_render_vertices(model, &color_only_instanced, glm::vec3(points_and_lines_color), 2);
+				model.EndRepeats();
+			}
 			break;
 		case 2:
-			current_shader = &color_only;
+			current_shader = &edge_lines;
+			current_shader->SetModel(model_matrix);
 			mode_render_triangles(model, current_shader, glm::vec3(points_and_lines_color));
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_render_triangles(model, &edge_lines_instanced, glm::vec3(points_and_lines_color));
+				model.EndRepeats();
+			}
 			break;
 		case 3:
 			current_shader = &color_only;
+			current_shader->SetModel(model_matrix);
 			mode_render_filled_triangles(model, current_shader, glm::vec3(filled_color));
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_render_filled_triangles(model, &color_only_instanced, glm::vec3(filled_color));
+				model.EndRepeats();
+			}
 			break;
 		case 4:
-			current_shader = &color_only;
-			mode_render_filled_triangles(model, current_shader, glm::vec3(filled_color));
-			mode_render_triangles(model, current_shader, glm::vec3(points_and_lines_color));
+			current_shader = &wireframe_overlay;
+			current_shader->SetModel(model_matrix);
+			mode_render_wireframe_overlay(model, current_shader, glm::vec3(filled_color), glm::vec3(points_and_lines_color), wire_width, viewport_size);
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_render_wireframe_overlay(model, &wireframe_overlay_instanced, glm::vec3(filled_color), glm::vec3(points_and_lines_color), wire_width, viewport_size);
+				model.EndRepeats();
+			}
 			break;
 		case 5:
-			current_shader = &color_only;
-			mode_render_filled_triangles(model, current_shader, glm::vec3(filled_color));
-			mode_render_triangles(model, current_shader, glm::vec3(points_and_lines_color));
-			mode_render_normals(model, current_shader, all_normals_color);
+			current_shader = &wireframe_overlay;
+			current_shader->SetModel(model_matrix);
+			mode_render_wireframe_overlay(model, current_shader, glm::vec3(filled_color), glm::vec3(points_and_lines_color), wire_width, viewport_size);
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_render_wireframe_overlay(model, &wireframe_overlay_instanced, glm::vec3(filled_color), glm::vec3(points_and_lines_color), wire_width, viewport_size);
+				model.EndRepeats();
+			}
+			current_shader = &normal_lines;
+			current_shader->SetModel(model_matrix);
+			mode_render_normals(model, current_shader, all_normals_color, normal_length);
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_render_normals(model, &normal_lines_instanced, all_normals_color, normal_length);
+				model.EndRepeats();
+			}
 			break;
 		case 6:
-			current_shader = &color_only;
-			mode_render_filled_triangles(model, current_shader, glm::vec3(filled_color));
-			mode_render_triangles(model, current_shader, glm::vec3(points_and_lines_color));
-			mode_averaged_normals(model, current_shader, averaged_normals_color);
+			current_shader = &wireframe_overlay;
+			current_shader->SetModel(model_matrix);
+			mode_render_wireframe_overlay(model, current_shader, glm::vec3(filled_color), glm::vec3(points_and_lines_color), wire_width, viewport_size);
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_render_wireframe_overlay(model, &wireframe_overlay_instanced, glm::vec3(filled_color), glm::vec3(points_and_lines_color), wire_width, viewport_size);
+				model.EndRepeats();
+			}
+			current_shader = &normal_lines;
+			current_shader->SetModel(model_matrix);
+			mode_averaged_normals(model, current_shader, averaged_normals_color, normal_length);
+			if (model.BeginRepeats(model_matrix))
+			{
+				mode_averaged_normals(model, &normal_lines_instanced, averaged_normals_color, normal_length);
+				model.EndRepeats();
+			}
 			break;
 		case 7:
+		{
+			// More than one instance draws the whole grid with the instanced variants
+			const InstanceGrid* grid = instance_count > 1 ? &instance_grid : nullptr;
+			const unsigned instancing = grid ? SHADER_INSTANCING : 0;
+			if (grid)
+			{
+				instance_grid.Cull(frame_data.Projection * frame_data.View);
+			}
+			ShaderPermutations* material = &flat_shader_material;
+			unsigned features = 0;
 			switch (state.shading_mode)
 			{
-			case flat:
-				current_shader = &flat_shader_material;
-				glUseProgram(current_shader->GetId());
-				model.RenderFlat();
-				break;
 			case gouraud:
-				current_shader = &gouraud_shader_material;
-				glUseProgram(current_shader->GetId());
-				model.RenderSmooth();
+				material = &gouraud_shader_material;
+				features = light_features;
 				break;
 			case phong:
-				current_shader = &phong_shader_material;
-				glUseProgram(current_shader->GetId());
-				model.RenderSmooth();
+				material = &phong_shader_material;
+				features = light_features;
+				break;
+			default:
 				break;
 			}
+			const bool smooth = state.shading_mode != flat;
+			current_shader = &material->Get(features | instancing);
+			current_shader->SetModel(model_matrix);
+			mode_render_shaded(model, current_shader, grid, smooth);
+			// The grid draws repeats with each instance
+			if (!grid && model.BeginRepeats(model_matrix))
+			{
+				mode_render_shaded(model, &material->Get(features | SHADER_INSTANCING), nullptr, smooth);
+				model.EndRepeats();
+			}
 			break;
+		}
 		case 8:
-			current_shader = &phong_shader_material_texture;
-			mode_render_with_texture(model, test_texture, test_specular_texture, current_shader);
+			// Models without material textures show the test textures instead
+			if (model.HasTextures())
+			{
+				current_shader = &phong_shader_material.Get(light_features | SHADER_TEXTURE_ARRAY);
+				current_shader->SetModel(model_matrix);
+				model.RenderTextured(*current_shader);
+				if (model.BeginRepeats(model_matrix))
+				{
+					model.RenderTextured(phong_shader_material.Get(light_features | SHADER_TEXTURE_ARRAY | SHADER_INSTANCING));
+					model.EndRepeats();
+				}
+			}
+			else
+			{
+				current_shader = &phong_shader_material.Get(light_features | SHADER_TEXTURE);
+				current_shader->SetModel(model_matrix);
+				mode_render_with_texture(model, test_texture, test_specular_texture, current_shader);
+				if (model.BeginRepeats(model_matrix))
+				{
+					mode_render_with_texture(model, test_texture, test_specular_texture, &phong_shader_material.Get(light_features | SHADER_TEXTURE | SHADER_INSTANCING));
+					model.EndRepeats();
+				}
+			}
 			break;
 		default:
 			break;
 		}
+		geometry_allocations = AllocCounter::GetCount() - allocations_before_geometry;
 
 		glBindVertexArray(0);
-		glUseProgram(0);
+		Shader::Unbind();
 
 		if (show_gui)
 		{
@@ -623,11 +843,100 @@ int main()
 			ImGui::Text("Disable mouse - E (hold)");
 			ImGui::Separator();
 			ImGui::Text("Switching modes - 1 2 3 4 5 6 7 8");
+			ImGui::SliderFloat("Wireframe width (px)", &wire_width, 0.5f, 5.0f);
+			ImGui::SliderFloat("Normal length", &normal_length, 0.01f, 2.0f);
+			ImGui::Text("Wireframe edges: %u (%u drawn per triangle)", model.GetEdgeCount(), model.GetTriangleCount() * 3);
+			const VertexCacheStats cache_stats = model.GetCacheStats();
+			ImGui::Text("ACMR: %.3f in file order, %.3f optimized", VertexCacheStats::Acmr(cache_stats.MissesBefore, cache_stats.Triangles),
+				VertexCacheStats::Acmr(cache_stats.MissesFetch, cache_stats.Triangles));
+			ImGui::Separator();
+			if (ImGui::SliderInt("Instances (mode 7)", &instance_count, 1, INSTANCE_GRID_MAX_COUNT))
+			{
+				instance_grid.Build(instance_count, model.GetBoundingBox(), model_matrix);
+			}
+			if (instance_count > 1)
+			{
+				ImGui::Text("Instances visible: %u of %u", instance_grid.GetVisibleCount(), instance_grid.GetCount());
+			}
+			const ImportStats& import_stats = model.GetImportStats();
+			ImGui::Text("Mesh placements: %u from %u unique meshes (%u repeats instanced)", import_stats.Placements,
+				import_stats.UniqueMeshes, model.GetRepeatCount());
+			ImGui::Text("Deduplicated: %zu KiB of vertex and index data", import_stats.DedupedBytes / 1024);
 			ImGui::Separator();
 			ImGui::Text("Switching shading type:");
 			ImGui::Text("Flat - I");
 			ImGui::Text("Gouraud - O");
 			ImGui::Text("Phong - P");
+			ImGui::Separator();
+			ImGui::Text("Geometry allocations per frame: %u", static_cast<unsigned>(geometry_allocations));
+			ImGui::Text("Uniform uploads per frame: %u (%u unchanged skipped)", uniform_stats.Uploads, uniform_stats.Skipped);
+			ImGui::Text("Uniform block updates per frame: %u", uniform_block_updates);
+			ImGui::Text("Model draw calls per frame: %u, vertex array binds: %u", render_stats.DrawCalls, render_stats.VertexArrayBinds);
+			bool frustum_culling = model.IsCulling();
+			if (ImGui::Checkbox("Frustum culling", &frustum_culling))
+			{
+				model.SetCulling(frustum_culling);
+			}
+			if (GpuCuller::IsAvailable())
+			{
+				bool gpu_culling = model.IsGpuCulling();
+				if (ImGui::Checkbox(GpuCuller::IsCompacting() ? "GPU culling (indirect draw count)" : "GPU culling (indirect draws)", &gpu_culling))
+				{
+					model.SetGpuCulling(gpu_culling);
+				}
+				const GpuCullStats gpu_cull_stats = model.GetGpuCullStats();
+				ImGui::Text("GPU culled passes: %u of %u meshes each, fell back to CPU: %u", gpu_cull_stats.Dispatches,
+					gpu_cull_stats.MeshesPerDispatch, gpu_cull_stats.Fallbacks);
+			}
+			const CullStats cull_stats = model.GetCullStats();
+			ImGui::Text("Meshes visible: %u, culled: %u (CPU)", cull_stats.Visible, cull_stats.Culled);
+			bool occlusion_culling = model.IsOcclusionCulling();
+			if (ImGui::Checkbox("Occlusion culling", &occlusion_culling))
+			{
+				model.SetOcclusionCulling(occlusion_culling);
+			}
+			const OcclusionStats occlusion_stats = model.GetOcclusionStats();
+			ImGui::Text("Occluded: %u of %u tested (%.0f%%), %u occluder triangles, %.2f ms", occlusion_stats.Occluded, occlusion_stats.Tested,
+				occlusion_stats.Tested ? 100.0 * occlusion_stats.Occluded / occlusion_stats.Tested : 0.0, occlusion_stats.OccluderTriangles, occlusion_stats.Ms);
+			ImGui::Text("Geometry arena: %.2f of %.2f MiB used", GeometryArena::GetUsedBytes() / (1024.0 * 1024.0),
+				GeometryArena::GetCapacityBytes() / (1024.0 * 1024.0));
+			if (const TextureAtlas* atlas = model.GetAtlas())
+			{
+				ImGui::Text("Texture arrays: %u with %u layers, binds per frame: %u", atlas->GetArrayCount(), atlas->GetLayerCount(), texture_array_binds);
+			}
+			const ShaderStartupReport shader_stats = Shader::GetStartupReport();
+			ImGui::Text("Shader programs cached: %u, compiled: %u, failed: %u, pending: %u", shader_stats.Cached, shader_stats.Compiled,
+				shader_stats.Failed, shader_stats.Pending);
+			ImGui::Text("Shader compile time saved: %.1f ms", shader_stats.SavedMs);
+			const TextureCacheStats texture_stats = TextureCache::GetStats();
+			ImGui::Text("Textures: %u loaded, cache hits: %u, misses: %u", texture_stats.Textures, texture_stats.Hits, texture_stats.Misses);
+			ImGui::Text("Textures pending: %u, upload time: %.2f ms", texture_stats.Pending, texture_stats.UploadMs);
+			ImGui::Text("Textures compressed: %u, VRAM: %.2f MiB, load time: %.1f ms", texture_stats.Compressed,
+				texture_stats.VideoMemoryBytes / (1024.0 * 1024.0), texture_stats.LoadMs);
+			if (ImGui::SliderFloat("Texture upload budget (ms)", &texture_upload_budget, 0.0f, 16.0f))
+			{
+				TextureCache::SetUploadBudget(texture_upload_budget);
+			}
+			ImGui::Separator();
+			if (ImGui::Combo("CPU geometry", &residency_policy, "Release after upload\0Keep\0Keep compressed\0"))
+			{
+				model.SetResidencyPolicy(static_cast<EResidencyPolicy>(residency_policy));
+			}
+			ImGui::Text("CPU geometry memory: %.1f KiB", model.GetCpuBytes() / 1024.0);
+			if (SmoothNormals::IsAvailable())
+			{
+				bool gpu_smooth_normals = SmoothNormals::IsEnabled();
+				if (ImGui::Checkbox("GPU smooth normals (large meshes)", &gpu_smooth_normals))
+				{
+					SmoothNormals::SetEnabled(gpu_smooth_normals);
+				}
+			}
+			else
+			{
+				ImGui::Text("GPU smooth normals: needs OpenGL 4.3");
+			}
+			const SmoothNormalsStats smooth_stats = SmoothNormals::GetStats();
+			ImGui::Text("Smooth normals built on GPU: %u (%.2f ms), on CPU: %u", smooth_stats.GpuMeshes, smooth_stats.GpuMs, smooth_stats.CpuMeshes);
 			ImGui::End();
 
 			ImGui::Render();
@@ -640,6 +949,15 @@ int main()
 
 	ImGui_ImplGlfwGL3_Shutdown();
 	ImGui::DestroyContext();
+	// Everything owning GL objects lets go of them while the context still exists
+	model.Unload();
+	instance_grid.Release();
+	frame_block.Release();
+	light_block.Release();
+	material_block.Release();
+	TextureCache::Release(test_texture);
+	TextureCache::Release(test_specular_texture);
 	glfwTerminate();
+	MeshCache::Flush();
 	return 0;
 }
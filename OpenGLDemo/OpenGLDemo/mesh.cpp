@@ -1,371 +1,544 @@
 #include "mesh.hpp"
 
-#include <fstream>
+#include "mesh_cache.hpp"
+#include "buffer_codec.hpp"
+#include "thread_pool.hpp"
+#include "edge_list.hpp"
+#include "smooth_normals.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <utility>
 #include <glm/vec3.hpp>
 #include <glm/detail/func_geometric.inl>
 
-Mesh::Mesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath, const int meshNumber) {
-	processMesh(mesh, material, resPath, meshNumber);
+Mesh::Mesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath, EResidencyPolicy residency, const aiMatrix4x4& transform) {
+	mResidency = residency;
+	processMesh(mesh, material, resPath, transform);
 }
 
+Mesh::Mesh(Mesh&& other) noexcept {
+	takeFrom(other);
+}
 
-void
-Mesh::RenderFlat() const {
-	glBindVertexArray(mVAO_flat);
+Mesh&
+Mesh::operator=(Mesh&& other) noexcept {
+	if (this != &other) {
+		waitForJobs();
+		release();
+		takeFrom(other);
+	}
+	return *this;
+}
 
-	if (mIndexCount) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO_flat);
-		glDrawElements(GL_TRIANGLES, mIndexCount, GL_UNSIGNED_INT, (void*)0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		return;
+Mesh::~Mesh() {
+	waitForJobs();
+	release();
+}
+
+void
+Mesh::waitForJobs() {
+	// Jobs read this mesh, so they have to finish before it moves or dies
+	if (mSmoothJob.valid()) {
+		mSmoothJob.wait();
 	}
-	glDrawArrays(GL_TRIANGLES, 0, mVertexCount);
-	glBindVertexArray(0);
 }
 
 void
-Mesh::RenderSmooth() const {
-	glBindVertexArray(mVAO_smooth);
-	if (mIndexCount) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO_smooth);
-		glDrawElements(GL_TRIANGLES, mIndexCount, GL_UNSIGNED_INT, (void*)0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+Mesh::release() {
+	// Empty ranges are ignored by the arena
+	GeometryArena::FreeVertices(mFlatVertices);
+	GeometryArena::FreeVertices(mSmoothVertices);
+	GeometryArena::FreeIndices(mIndexRange);
+	GeometryArena::FreeIndices(mEdgeRange);
+	GeometryArena::FreeIndices(mWeldRange);
+}
+
+void
+Mesh::takeFrom(Mesh& other) {
+	other.waitForJobs();
+	mSmoothJob = std::move(other.mSmoothJob);
+	mSourceKey = other.mSourceKey;
+	mCacheStats = other.mCacheStats;
+	mBox = other.mBox;
+	mSphere = other.mSphere;
+	mOccluder = std::move(other.mOccluder);
+	mFlatVertices = std::exchange(other.mFlatVertices, ArenaAllocation());
+	mSmoothVertices = std::exchange(other.mSmoothVertices, ArenaAllocation());
+	mIndexRange = std::exchange(other.mIndexRange, ArenaAllocation());
+	mEdgeRange = std::exchange(other.mEdgeRange, ArenaAllocation());
+	mEdgeIndices = std::move(other.mEdgeIndices);
+	mWeldRange = std::exchange(other.mWeldRange, ArenaAllocation());
+	mWeldIndices = std::move(other.mWeldIndices);
+	mWeldGroups = std::move(other.mWeldGroups);
+	mWeldGroupCount = std::exchange(other.mWeldGroupCount, 0);
+	mVertices_flat = std::move(other.mVertices_flat);
+	mVertices_smooth = std::move(other.mVertices_smooth);
+	mVertexCount = std::exchange(other.mVertexCount, 0);
+	mIndexCount = std::exchange(other.mIndexCount, 0);
+	mDiffuseSlot = other.mDiffuseSlot;
+	mSpecularSlot = other.mSpecularSlot;
+	mDiffusePath = std::move(other.mDiffusePath);
+	mSpecularPath = std::move(other.mSpecularPath);
+	mIndices = std::move(other.mIndices);
+	mResidency = other.mResidency;
+	mCompressedVertices = std::move(other.mCompressedVertices);
+	mCompressedIndices = std::move(other.mCompressedIndices);
+}
+
+bool
+Mesh::hasPendingJobs() const {
+	return mSmoothJob.valid();
+}
+
+template <typename T>
+static void
+releaseVector(std::vector<T>& data) {
+	std::vector<T>().swap(data);
+}
+
+template <typename T>
+static size_t
+vectorBytes(const std::vector<T>& data) {
+	return data.capacity() * sizeof(T);
+}
+
+void
+Mesh::applyResidency() {
+	if (mResidency == RESIDENCY_KEEP) {
+		if (!mCompressedVertices.empty() || !mCompressedIndices.empty()) {
+			materializeFlat();
+			releaseVector(mCompressedVertices);
+			releaseVector(mCompressedIndices);
+		}
 		return;
 	}
-	glDrawArrays(GL_TRIANGLES, 0, mVertexCount);
-	glBindVertexArray(0);
+
+	// Derived buffers are cheap to get back from the disk cache
+	if (mSmoothVertices.Count) releaseVector(mVertices_smooth);
+
+	// Running jobs still read the flat vertices
+	if (!mFlatVertices.Count || hasPendingJobs()) {
+		return;
+	}
+	if (mResidency == RESIDENCY_COMPRESSED) {
+		if (mCompressedVertices.empty() && mCompressedIndices.empty()) {
+			materializeFlat();
+			mCompressedVertices = BufferCodec::Compress(mVertices_flat.data(), mVertices_flat.size(), 8);
+			mCompressedIndices = BufferCodec::Compress(mIndices.data(), mIndices.size(), 1);
+		}
+	}
+	else {
+		releaseVector(mCompressedVertices);
+		releaseVector(mCompressedIndices);
+	}
+	releaseVector(mVertices_flat);
+	releaseVector(mIndices);
 }
 
 void
-Mesh::RenderTriangles() const {
-	glBindVertexArray(mVAO_flat);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	if (mIndexCount) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO_flat);
-		glDrawElements(GL_TRIANGLES, mIndexCount, GL_UNSIGNED_INT, (void*)0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+Mesh::materializeFlat() {
+	if (mVertices_flat.empty() && mVertexCount) {
+		mVertices_flat.resize(static_cast<size_t>(mVertexCount) * 8);
+		if (mCompressedVertices.empty() || !BufferCodec::Decompress(mCompressedVertices, mVertices_flat.data(), mVertices_flat.size(), 8)) {
+			GeometryArena::ReadVertices(mFlatVertices, mVertices_flat.data());
+		}
+	}
+	if (mIndices.empty() && mIndexCount) {
+		mIndices.resize(mIndexCount);
+		if (mCompressedIndices.empty() || !BufferCodec::Decompress(mCompressedIndices, mIndices.data(), mIndices.size(), 1)) {
+			GeometryArena::ReadIndices(mIndexRange, mIndices.data());
+		}
 	}
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glBindVertexArray(0);
 }
 
 void
-Mesh::RenderFilledTriangles() const {
-	glBindVertexArray(mVAO_flat);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	if (mIndexCount) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO_flat);
-		glDrawElements(GL_TRIANGLES, mIndexCount, GL_UNSIGNED_INT, (void*)0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+Mesh::SetResidencyPolicy(EResidencyPolicy policy) {
+	mResidency = policy;
+	applyResidency();
+}
+
+const std::vector<float>&
+Mesh::GetFlatVertices() {
+	materializeFlat();
+	return mVertices_flat;
+}
+
+const std::vector<unsigned>&
+Mesh::GetIndices() {
+	materializeFlat();
+	return mIndices;
+}
+
+const std::vector<float>&
+Mesh::GetSmoothVertices() {
+	if (mVertices_smooth.empty() && mVertexCount) {
+		if (mSmoothVertices.Count) {
+			mVertices_smooth.resize(static_cast<size_t>(mVertexCount) * 8);
+			GeometryArena::ReadVertices(mSmoothVertices, mVertices_smooth.data());
+		}
+		else {
+			waitForJobs();
+			materializeFlat();
+			mVertices_smooth = buildSmoothVertices();
+		}
 	}
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glBindVertexArray(0);
+	return mVertices_smooth;
 }
 
-void
-Mesh::RenderVertices() const {
-	glBindVertexArray(mVAO_flat);
-	if (mIndexCount) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO_flat);
-		glDrawElements(GL_POINTS, mIndexCount, GL_UNSIGNED_INT, (void*)0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+size_t
+Mesh::GetCpuBytes() const {
+	return vectorBytes(mVertices_flat) + vectorBytes(mIndices)
+		+ vectorBytes(mVertices_smooth) + vectorBytes(mCompressedVertices) + vectorBytes(mCompressedIndices)
+		+ vectorBytes(mEdgeIndices) + vectorBytes(mWeldIndices) + vectorBytes(mWeldGroups)
+		+ vectorBytes(mOccluder);
+}
+
+
+DrawRange
+Mesh::GetFlatDraw() const {
+	return { static_cast<GLsizei>(mIndexRange.Count), mIndexRange.Offset, static_cast<GLint>(mFlatVertices.Offset) };
+}
+
+DrawRange
+Mesh::GetSmoothDraw() {
+	if (!mIndexRange.Count || !ensureSmoothVertices()) {
+		return GetFlatDraw();
 	}
-	glBindVertexArray(0);
+	return { static_cast<GLsizei>(mIndexRange.Count), mIndexRange.Offset, static_cast<GLint>(mSmoothVertices.Offset) };
 }
 
-void
-Mesh::RenderNormals() const {
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glBindVertexArray(normal_lines_vao);
-	glDrawArrays(GL_LINES, 0, normal_line_vertices.size() / 3);
-	glBindVertexArray(0);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+DrawRange
+Mesh::GetEdgeDraw() const {
+	return { static_cast<GLsizei>(mEdgeRange.Count), mEdgeRange.Offset, static_cast<GLint>(mFlatVertices.Offset) };
+}
+
+unsigned
+Mesh::GetEdgeCount() const {
+	return mEdgeRange.Count / 4;
+}
+
+unsigned
+Mesh::GetTriangleCount() const {
+	return mIndexCount / 3;
+}
+
+const VertexCacheStats&
+Mesh::GetCacheStats() const {
+	return mCacheStats;
+}
+
+const BoundingBox&
+Mesh::GetBoundingBox() const {
+	return mBox;
+}
+
+const BoundingSphere&
+Mesh::GetBoundingSphere() const {
+	return mSphere;
+}
+
+const std::vector<glm::vec3>&
+Mesh::GetOccluder() const {
+	return mOccluder;
+}
+
+DrawRange
+Mesh::GetVertexDraw() const {
+	return { static_cast<GLsizei>(mFlatVertices.Count), 0, static_cast<GLint>(mFlatVertices.Offset) };
+}
+
+DrawRange
+Mesh::GetWeldedVertexDraw() {
+	if (!mWeldRange.Count || !ensureSmoothVertices()) {
+		return { 0, 0, 0 };
+	}
+	return { static_cast<GLsizei>(mWeldRange.Count), mWeldRange.Offset, static_cast<GLint>(mSmoothVertices.Offset) };
+}
+
+const std::string&
+Mesh::GetDiffusePath() const {
+	return mDiffusePath;
+}
+
+const std::string&
+Mesh::GetSpecularPath() const {
+	return mSpecularPath;
 }
+
 void
-Mesh::RenderAveragedNormals() const {
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glBindVertexArray(averaged_normal_lines_vao);
-	glDrawArrays(GL_LINES, 0, averaged_normal_vertices.size() / 3);
-	glBindVertexArray(0);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+Mesh::SetTextureSlots(AtlasSlot diffuse, AtlasSlot specular) {
+	mDiffuseSlot = diffuse;
+	mSpecularSlot = specular;
 }
 
+AtlasSlot
+Mesh::GetDiffuseSlot() const {
+	return mDiffuseSlot;
+}
 
-unsigned
-Mesh::loadMeshTexture(const aiMaterial* material, const std::string& resPath, aiTextureType type) {
+AtlasSlot
+Mesh::GetSpecularSlot() const {
+	return mSpecularSlot;
+}
+
+std::string
+Mesh::meshTexturePath(const aiMaterial* material, const std::string& resPath, aiTextureType type) {
 	if (material && material->GetTextureCount(type) > 0) {
 		aiString Path;
 		if (material->GetTexture(type, 0, &Path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
-			std::string FullPath = resPath + "/" + Path.data;
-			unsigned TextureID = Texture::LoadImageToTexture(FullPath);
-			return TextureID;
+			return resPath + "/" + Path.data;
 		}
 	}
-	return 0;
+	return "";
 }
 
 
 
 
-bool contains_element(const glm::vec3& target, const std::vector<glm::vec3>& added) {
-	return std::find(added.begin(), added.end(), target) != added.end();
-}
-
-
-void Mesh::processVertices(const aiMesh* mesh, const aiVector3D Zero3D)
+void Mesh::processVertices(const aiMesh* mesh, const aiVector3D Zero3D, const aiMatrix4x4& transform)
 {
+	// Node transforms are baked in, normals go through the inverse transpose
+	const bool Transformed = !transform.IsIdentity();
+	const aiMatrix3x3 NormalTransform = aiMatrix3x3(transform).Inverse().Transpose();
 	for (unsigned VertexIndex = 0; VertexIndex < mesh->mNumVertices; ++VertexIndex) {
-		std::vector<float> Position = { mesh->mVertices[VertexIndex].x, mesh->mVertices[VertexIndex].y, mesh->mVertices[VertexIndex].z };
+		aiVector3D Vertex = mesh->mVertices[VertexIndex];
+		aiVector3D Normal = mesh->mNormals[VertexIndex];
+		if (Transformed) {
+			Vertex = transform * Vertex;
+			Normal = (NormalTransform * Normal).Normalize();
+		}
+		std::vector<float> Position = { Vertex.x, Vertex.y, Vertex.z };
 		mVertices_flat.insert(mVertices_flat.end(), Position.begin(), Position.end());
-		std::vector<float> Normals = { mesh->mNormals[VertexIndex].x, mesh->mNormals[VertexIndex].y, mesh->mNormals[VertexIndex].z };
+		std::vector<float> Normals = { Normal.x, Normal.y, Normal.z };
 		mVertices_flat.insert(mVertices_flat.end(), Normals.begin(), Normals.end());
 		const aiVector3D* TexCoords = mesh->HasTextureCoords(0) ? &(mesh->mTextureCoords[0][VertexIndex]) : &Zero3D;
 		std::vector<float> UV = { TexCoords->x, TexCoords->y };
 		mVertices_flat.insert(mVertices_flat.end(), UV.begin(), UV.end());
 	}
+	processBounds();
 }
 
-void Mesh::processIndices(const aiMesh* mesh)
+void
+Mesh::processBounds() {
+	const size_t VertexCount = mVertices_flat.size() / 8;
+	if (!VertexCount) {
+		return;
+	}
+	auto Position = [this](size_t Vertex) {
+		return glm::vec3(mVertices_flat[Vertex * 8], mVertices_flat[Vertex * 8 + 1], mVertices_flat[Vertex * 8 + 2]);
+	};
+	glm::vec3 Min = Position(0);
+	glm::vec3 Max = Min;
+	for (size_t Vertex = 1; Vertex < VertexCount; ++Vertex) {
+		Min = glm::min(Min, Position(Vertex));
+		Max = glm::max(Max, Position(Vertex));
+	}
+	mBox = { Min, Max };
+	// Around the box center, which is tighter than half the diagonal
+	mSphere.Center = 0.5f * (Min + Max);
+	float RadiusSquared = 0.0f;
+	for (size_t Vertex = 0; Vertex < VertexCount; ++Vertex) {
+		const glm::vec3 Offset = Position(Vertex) - mSphere.Center;
+		RadiusSquared = std::max(RadiusSquared, glm::dot(Offset, Offset));
+	}
+	mSphere.Radius = std::sqrt(RadiusSquared);
+}
+
+void Mesh::processIndices(const aiMesh* mesh, bool mirrored)
 {
+	// A mirroring transform turns counter-clockwise triangles clockwise, swapping
+	// two corners puts the front faces back on the outside
+	const unsigned Second = mirrored ? 2 : 1;
+	const unsigned Third = mirrored ? 1 : 2;
 	for (unsigned FaceIndex = 0; FaceIndex < mesh->mNumFaces; ++FaceIndex) {
 		const aiFace& Face = mesh->mFaces[FaceIndex];
 		mIndices.push_back(Face.mIndices[0]);
-		mIndices.push_back(Face.mIndices[1]);
-		mIndices.push_back(Face.mIndices[2]);
+		mIndices.push_back(Face.mIndices[Second]);
+		mIndices.push_back(Face.mIndices[Third]);
 	}
 
 	mVertexCount = mVertices_flat.size() / 8;
+	// Meshes without faces used to be drawn with glDrawArrays, every draw
+	// path is indexed now so they get the same triangles as sequential indices
+	if (mIndices.empty()) {
+		mIndices.resize(mVertexCount - mVertexCount % 3);
+		for (unsigned Index = 0; Index < mIndices.size(); ++Index) {
+			mIndices[Index] = Index;
+		}
+		for (unsigned Index = 0; mirrored && Index < mIndices.size(); Index += 3) {
+			std::swap(mIndices[Index + 1], mIndices[Index + 2]);
+		}
+	}
 	mIndexCount = mIndices.size();
 }
 
-void Mesh::processTextures(const aiMaterial* material, const std::string& resPath)
-{
-	mDiffuseTexture = loadMeshTexture(material, resPath, aiTextureType_DIFFUSE);
-	mSpecularTexture = loadMeshTexture(material, resPath, aiTextureType_SPECULAR);
+void
+Mesh::optimizeGeometry() {
+	// Before anything is derived from the order of vertices and triangles
+	mCacheStats = MeshOptimizer::Optimize(mVertices_flat, 8, mIndices);
 }
 
-void Mesh::flatSetup()
+void Mesh::processTopology()
 {
-	glGenVertexArrays(1, &mVAO_flat);
-	glBindVertexArray(mVAO_flat);
-	glGenBuffers(1, &mVBO_flat);
-	glBindBuffer(GL_ARRAY_BUFFER, mVBO_flat);
-	glBufferData(GL_ARRAY_BUFFER, mVertices_flat.size() * sizeof(float), mVertices_flat.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	if (mIndexCount) {
-		glGenBuffers(1, &mEBO_flat);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO_flat);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndexCount * sizeof(float), mIndices.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	}
-	glBindVertexArray(0);
-}
-
-void Mesh::normalLinesSetup()
-{
-	for (size_t i = 0; i < mVertices_flat.size(); i += 8) {
-		float x = mVertices_flat[i];
-		float y = mVertices_flat[i + 1];
-		float z = mVertices_flat[i + 2];
-		float nx = mVertices_flat[i + 3];
-		float ny = mVertices_flat[i + 4];
-		float nz = mVertices_flat[i + 5];
-		glm::vec3 start_point(x, y, z);
-		glm::vec3 direction(nx, ny, nz);
-		direction = normalize(direction);
-		glm::vec3 scaled_direction = 0.2f * direction;
-		glm::vec3 end_point = start_point + scaled_direction;
-		normal_line_vertices.push_back(start_point.x);
-		normal_line_vertices.push_back(start_point.y);
-		normal_line_vertices.push_back(start_point.z);
-		normal_line_vertices.push_back(end_point.x);
-		normal_line_vertices.push_back(end_point.y);
-		normal_line_vertices.push_back(end_point.z);
-	}
-	glGenVertexArrays(1, &normal_lines_vao);
-	glBindVertexArray(normal_lines_vao);
-	glGenBuffers(1, &normal_lines_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, normal_lines_vbo);
-	glBufferData(GL_ARRAY_BUFFER, normal_line_vertices.size() * sizeof(float), normal_line_vertices.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), static_cast<void*>(nullptr));
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-}
-
-void Mesh::averagedNormalsSetup(const int meshNumber, std::string& file_start, std::string& numStr, std::string& file_end, std::string& filename)
-{
-	file_start = "mesh_data/averaged_normal_vertices_";
-	numStr = std::to_string(meshNumber);
-	file_end = ".txt";
-	filename = file_start + numStr + file_end;
-	std::ifstream inputFile(filename);
-	if (inputFile.is_open()) {
-		float value;
-		while (inputFile >> value) {
-			averaged_normal_vertices.push_back(value);
-		}
-		inputFile.close();
+	const VertexWeld weld(mVertices_flat, 8, WELD_TOLERANCE);
+	mEdgeIndices = EdgeList(weld, mIndices).GetIndices();
+	mWeldIndices.reserve(weld.GetGroupCount());
+	for (unsigned Group = 0; Group < weld.GetGroupCount(); ++Group) {
+		mWeldIndices.push_back(weld.GetFirstVertex(Group));
 	}
-	else {
-		std::vector<glm::vec3> added_to_vertices;
-		for (size_t i = 0; i < mVertices_flat.size(); i += 8) {
-			glm::vec3 averaged_normal(0.0f);
-			std::vector<glm::vec3> added_to_current_normal_calculation;
-			float start_x = mVertices_flat[i];
-			float start_y = mVertices_flat[i + 1];
-			float start_z = mVertices_flat[i + 2];
-			if (!contains_element(glm::vec3(start_x, start_y, start_z), added_to_vertices))
-				added_to_vertices.emplace_back(start_x, start_y, start_z);
-			else continue;
-			for (size_t j = i; j < mVertices_flat.size(); j += 8) {
-				float current_x = mVertices_flat[j];
-				float current_y = mVertices_flat[j + 1];
-				float current_z = mVertices_flat[j + 2];
-				float current_nx = mVertices_flat[j + 3];
-				float current_ny = mVertices_flat[j + 4];
-				float current_nz = mVertices_flat[j + 5];
-				if (start_x == current_x && start_y == current_y && start_z == current_z) {
-					glm::vec3 current_normal(current_nx, current_ny, current_nz);
-					if (!contains_element(current_normal, added_to_current_normal_calculation)) {
-						averaged_normal += current_normal;
-						added_to_current_normal_calculation.push_back(current_normal);
-					}
-				}
-			}
-			if (averaged_normal != glm::vec3(0.0f)) {
-				averaged_normal = static_cast<float>(1.00 / added_to_current_normal_calculation.size()) * averaged_normal;
-				averaged_normal = glm::normalize(averaged_normal);
-				glm::vec3 scaled_direction = 0.2f * averaged_normal;
-				glm::vec3 end_point = glm::vec3(start_x, start_y, start_z) + scaled_direction;
-				averaged_normal_vertices.push_back(start_x);
-				averaged_normal_vertices.push_back(start_y);
-				averaged_normal_vertices.push_back(start_z);
-				averaged_normal_vertices.push_back(end_point.x);
-				averaged_normal_vertices.push_back(end_point.y);
-				averaged_normal_vertices.push_back(end_point.z);
-			}
-		}
-		std::ofstream output_file(filename);
-		if (output_file.is_open()) {
-			for (const float& value : averaged_normal_vertices) {
-				output_file << value << "\n";
-			}
-			output_file.close();
-		}
-		else {
-			std::cerr << "Unable to save data to file.\n";
-		}
+	if (mVertexCount < SMOOTH_NORMALS_GPU_MIN_VERTICES) {
+		return;
+	}
+	// Counting sort of the vertices by group keeps them in vertex order within a group
+	mWeldGroupCount = weld.GetGroupCount();
+	mWeldGroups.assign(mWeldGroupCount + 1 + mVertexCount, 0);
+	for (unsigned Vertex = 0; Vertex < mVertexCount; ++Vertex) {
+		++mWeldGroups[weld.GetGroup(Vertex) + 1];
+	}
+	for (unsigned Group = 0; Group < mWeldGroupCount; ++Group) {
+		mWeldGroups[Group + 1] += mWeldGroups[Group];
+	}
+	std::vector<unsigned> next(mWeldGroups.begin(), mWeldGroups.begin() + mWeldGroupCount);
+	for (unsigned Vertex = 0; Vertex < mVertexCount; ++Vertex) {
+		mWeldGroups[mWeldGroupCount + 1 + next[weld.GetGroup(Vertex)]++] = Vertex;
 	}
-	glGenVertexArrays(1, &averaged_normal_lines_vao);
-	glBindVertexArray(averaged_normal_lines_vao);
-	glGenBuffers(1, &averaged_normal_lines_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, averaged_normal_lines_vbo);
-	glBufferData(GL_ARRAY_BUFFER, averaged_normal_vertices.size() * sizeof(float), averaged_normal_vertices.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), static_cast<void*>(nullptr));
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
 }
 
-void Mesh::smoothSetup(std::string& file_start, std::string numStr, std::string file_end, std::string& filename)
-{
-	file_start = "mesh_data/smooth_vertices_";
-	filename = file_start + numStr + file_end;
-	std::ifstream inputFileSmooth(filename);
-	if (inputFileSmooth.is_open()) {
-		float value;
-		while (inputFileSmooth >> value) {
-			mVertices_smooth.push_back(value);
+void
+Mesh::processOccluder() {
+	auto Position = [this](unsigned Vertex) {
+		return glm::vec3(mVertices_flat[Vertex * 8], mVertices_flat[Vertex * 8 + 1], mVertices_flat[Vertex * 8 + 2]);
+	};
+	// Any subset of the surface is a safe occluder, the largest triangles hide the most
+	std::vector<std::pair<float, unsigned>> Triangles;
+	Triangles.reserve(mIndexCount / 3);
+	for (unsigned Triangle = 0; Triangle < mIndexCount / 3; ++Triangle) {
+		const glm::vec3 A = Position(mIndices[Triangle * 3]);
+		const glm::vec3 B = Position(mIndices[Triangle * 3 + 1]);
+		const glm::vec3 C = Position(mIndices[Triangle * 3 + 2]);
+		Triangles.emplace_back(glm::length(glm::cross(B - A, C - A)), Triangle);
+	}
+	const size_t Kept = std::min<size_t>(Triangles.size(), OCCLUDER_TRIANGLE_BUDGET);
+	std::partial_sort(Triangles.begin(), Triangles.begin() + Kept, Triangles.end(), std::greater<std::pair<float, unsigned>>());
+	mOccluder.reserve(Kept * 3);
+	for (size_t Rank = 0; Rank < Kept; ++Rank) {
+		for (unsigned Corner = 0; Corner < 3; ++Corner) {
+			mOccluder.push_back(Position(mIndices[Triangles[Rank].second * 3 + Corner]));
 		}
-		inputFileSmooth.close();
 	}
-	else {
+}
 
-		for (size_t i = 0; i < mVertices_flat.size(); i += 8) {
-			glm::vec3 averaged_normal(0.0f);
-			std::vector<glm::vec3> added_to_current_normal_calculation;
-			float start_x = mVertices_flat[i];
-			float start_y = mVertices_flat[i + 1];
-			float start_z = mVertices_flat[i + 2];
-			for (size_t j = 0; j < mVertices_flat.size(); j += 8) {
-				float current_x = mVertices_flat[j];
-				float current_y = mVertices_flat[j + 1];
-				float current_z = mVertices_flat[j + 2];
-				float current_nx = mVertices_flat[j + 3];
-				float current_ny = mVertices_flat[j + 4];
-				float current_nz = mVertices_flat[j + 5];
-				if (start_x == current_x && start_y == current_y && start_z == current_z) {
-					glm::vec3 current_normal(current_nx, current_ny, current_nz);
-					if (!contains_element(current_normal, added_to_current_normal_calculation)) {
-						averaged_normal += current_normal;
-						added_to_current_normal_calculation.push_back(current_normal);}
-				}
-			}
-			averaged_normal = static_cast<float>(1.00 / added_to_current_normal_calculation.size()) * averaged_normal;
-			mVertices_smooth.push_back(start_x);
-			mVertices_smooth.push_back(start_y);
-			mVertices_smooth.push_back(start_z);
-			mVertices_smooth.push_back(averaged_normal.x);
-			mVertices_smooth.push_back(averaged_normal.y);
-			mVertices_smooth.push_back(averaged_normal.z);
-			mVertices_smooth.push_back(mVertices_flat[i + 6]);
-			mVertices_smooth.push_back(mVertices_flat[i + 7]);
-		}
+void Mesh::processTextures(const aiMaterial* material, const std::string& resPath)
+{
+	mDiffusePath = meshTexturePath(material, resPath, aiTextureType_DIFFUSE);
+	mSpecularPath = meshTexturePath(material, resPath, aiTextureType_SPECULAR);
+}
 
+void Mesh::flatSetup()
+{
+	mFlatVertices = GeometryArena::AllocateVertices(mVertices_flat.data(), mVertexCount);
+	mIndexRange = GeometryArena::AllocateIndices(mIndices.data(), mIndexCount);
+	// Edges and welded vertices are only drawn, so there is nothing to keep them around for
+	mEdgeRange = GeometryArena::AllocateIndices(mEdgeIndices.data(), static_cast<unsigned>(mEdgeIndices.size()));
+	mWeldRange = GeometryArena::AllocateIndices(mWeldIndices.data(), static_cast<unsigned>(mWeldIndices.size()));
+	releaseVector(mEdgeIndices);
+	releaseVector(mWeldIndices);
+}
 
-		std::ofstream output_file(filename);
-		if (output_file.is_open()) {
-			for (const float& value : mVertices_smooth) {
-				output_file << value << "\n";
-			}
-			output_file.close();
-		}
-		else {
-			std::cerr << "Unable to save data to file.\n";
-		}
+std::vector<float> Mesh::buildSmoothVertices() const
+{
+	std::vector<float> smooth_vertices;
+	if (MeshCache::Load("smooth_vertices", mSourceKey, smooth_vertices)) {
+		return smooth_vertices;
 	}
 
-	glGenVertexArrays(1, &mVAO_smooth);
-	glBindVertexArray(mVAO_smooth);
-	glGenBuffers(1, &mVBO_smooth);
-	glBindBuffer(GL_ARRAY_BUFFER, mVBO_smooth);
-	glBufferData(GL_ARRAY_BUFFER, mVertices_smooth.size() * sizeof(float), mVertices_smooth.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	const VertexWeld weld(mVertices_flat, 8, WELD_TOLERANCE);
+	smooth_vertices.reserve(mVertices_flat.size());
+	for (size_t i = 0; i < mVertices_flat.size(); i += 8) {
+		const unsigned Group = weld.GetGroup(static_cast<unsigned>(i / 8));
+		glm::vec3 averaged_normal = static_cast<float>(1.00 / weld.GetNormalCount(Group)) * weld.GetNormalSum(Group);
+		smooth_vertices.push_back(mVertices_flat[i]);
+		smooth_vertices.push_back(mVertices_flat[i + 1]);
+		smooth_vertices.push_back(mVertices_flat[i + 2]);
+		smooth_vertices.push_back(averaged_normal.x);
+		smooth_vertices.push_back(averaged_normal.y);
+		smooth_vertices.push_back(averaged_normal.z);
+		smooth_vertices.push_back(mVertices_flat[i + 6]);
+		smooth_vertices.push_back(mVertices_flat[i + 7]);
+	}
+	MeshCache::Store("smooth_vertices", mSourceKey, smooth_vertices);
+	return smooth_vertices;
+}
 
-	if (mIndexCount) {
-		glGenBuffers(1, &mEBO_smooth);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO_smooth);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndexCount * sizeof(float), mIndices.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+bool
+Mesh::collectJob(std::future<std::vector<float>>& job, std::vector<float>& target, std::vector<float> (Mesh::*build)() const) {
+	if (!job.valid()) {
+		materializeFlat();
+		job = ThreadPool::Shared().Submit([this, build] { return (this->*build)(); });
+		return false;
+	}
+	if (job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+		return false;
 	}
-	glBindVertexArray(0);
+	target = job.get();
+	return true;
+}
+
+bool
+Mesh::ensureSmoothVertices() {
+	if (mSmoothVertices.Count) {
+		return true;
+	}
+	if (!mSmoothJob.valid() && buildSmoothVerticesOnGpu()) {
+		releaseVector(mWeldGroups);
+		applyResidency();
+		return true;
+	}
+	if (!collectJob(mSmoothJob, mVertices_smooth, &Mesh::buildSmoothVertices)) {
+		return false;
+	}
+	smoothSetup();
+	SmoothNormals::CountCpuMesh();
+	releaseVector(mWeldGroups);
+	applyResidency();
+	return true;
+}
+
+bool
+Mesh::buildSmoothVerticesOnGpu() {
+	// Reads the flat vertices from the arena, so released flat data stays released
+	if (mWeldGroups.empty() || !mFlatVertices.Count || !SmoothNormals::IsEnabled() || !SmoothNormals::IsAvailable()) {
+		return false;
+	}
+	mSmoothVertices = GeometryArena::ReserveVertices(mVertexCount);
+	if (!SmoothNormals::Build(mFlatVertices, mSmoothVertices, mWeldGroups, mWeldGroupCount)) {
+		GeometryArena::FreeVertices(mSmoothVertices);
+		return false;
+	}
+	return true;
+}
+
+void Mesh::smoothSetup()
+{
+	mSmoothVertices = GeometryArena::AllocateVertices(mVertices_smooth.data(), mVertexCount);
 }
 
 void
-Mesh::processMesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath, const int meshNumber) {
+Mesh::processMesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath, const aiMatrix4x4& transform) {
 	const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
-	processVertices(mesh, Zero3D);
-	processIndices(mesh);
+	processVertices(mesh, Zero3D, transform);
+	processIndices(mesh, transform.Determinant() < 0.0f);
+	optimizeGeometry();
+	processTopology();
+	processOccluder();
 	processTextures(material, resPath);
+	mSourceKey = MeshCache::HashSource(mVertices_flat, WELD_TOLERANCE);
+}
+
+void
+Mesh::Upload() {
 	flatSetup();
-	normalLinesSetup();
-	std::string file_start;
-	std::string numStr;
-	std::string file_end;
-	std::string filename;
-	averagedNormalsSetup(meshNumber, file_start, numStr, file_end, filename);
-	smoothSetup(file_start, numStr, file_end, filename);
+	applyResidency();
 }
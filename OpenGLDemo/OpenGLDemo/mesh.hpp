@@ -2,56 +2,139 @@
 
 #include <assimp/scene.h>
 #include<vector>
+#include <future>
+#include <cstdint>
 #include <GL/glew.h>
 #include <iostream>
-#include "texture.hpp"
+#include "texture_atlas.hpp"
+#include "geometry_arena.hpp"
+#include "vertex_weld.hpp"
+#include "mesh_optimizer.hpp"
+#include "frustum.hpp"
+
+#define WELD_TOLERANCE 0.0f
+// Largest triangles kept as the software occluder of a mesh
+#define OCCLUDER_TRIANGLE_BUDGET 256
+
+// What a mesh keeps in system memory once its geometry is on the GPU
+enum EResidencyPolicy {
+	RESIDENCY_RELEASE = 0,
+	RESIDENCY_KEEP = 1,
+	RESIDENCY_COMPRESSED = 2,
+};
 
 class Mesh {
 
 private:
-	unsigned mVAO_flat;
-	unsigned mVBO_flat;
+	// Ranges of the shared geometry arena, the smooth vertices reuse the indices
+	ArenaAllocation mFlatVertices;
+	ArenaAllocation mSmoothVertices;
+	ArenaAllocation mIndexRange;
+	// Unique edges with their adjacent corners, only kept until upload
+	ArenaAllocation mEdgeRange;
+	std::vector<unsigned> mEdgeIndices;
+	// First vertex of every welded position, for one averaged normal each
+	ArenaAllocation mWeldRange;
+	std::vector<unsigned> mWeldIndices;
+	// Welded positions of large meshes for building smooth normals on the GPU:
+	// group starts followed by group members, kept until they are built
+	std::vector<unsigned> mWeldGroups;
+	unsigned mWeldGroupCount = 0;
 	std::vector<float> mVertices_flat;
-	unsigned mEBO_flat;
-
-	unsigned normal_lines_vao;
-	unsigned normal_lines_vbo;
-	std::vector<float> normal_line_vertices;
-
-	unsigned averaged_normal_lines_vao;
-	unsigned averaged_normal_lines_vbo;
-	std::vector<float> averaged_normal_vertices;
 
-	unsigned mVAO_smooth;
-	unsigned mVBO_smooth;
 	std::vector<float> mVertices_smooth;
-	unsigned mEBO_smooth;
 
-	unsigned mVertexCount;
-	unsigned mIndexCount;
-	unsigned mDiffuseTexture;
-	unsigned mSpecularTexture;
+	unsigned mVertexCount = 0;
+	unsigned mIndexCount = 0;
+	AtlasSlot mDiffuseSlot;
+	AtlasSlot mSpecularSlot;
+	std::string mDiffusePath;
+	std::string mSpecularPath;
 	std::vector<unsigned> mIndices;
 
-	unsigned loadMeshTexture(const aiMaterial* material, const std::string& resPath, aiTextureType type);
+	EResidencyPolicy mResidency = RESIDENCY_KEEP;
+	std::vector<unsigned char> mCompressedVertices;
+	std::vector<unsigned char> mCompressedIndices;
 
-	void processVertices(const aiMesh* mesh, aiVector3D Zero3D);
-	void processIndices(const aiMesh* mesh);
+	VertexCacheStats mCacheStats;
+	// Model space bounds of the positions
+	BoundingBox mBox;
+	BoundingSphere mSphere;
+	// Positions of a subset of the triangles, three per triangle, enough to
+	// hide what is behind the mesh without rasterizing all of it
+	std::vector<glm::vec3> mOccluder;
+	uint64_t mSourceKey = 0;
+	std::future<std::vector<float>> mSmoothJob;
+
+	void release();
+	void takeFrom(Mesh& other);
+	void waitForJobs();
+	bool hasPendingJobs() const;
+	void applyResidency();
+	void materializeFlat();
+	std::string meshTexturePath(const aiMaterial* material, const std::string& resPath, aiTextureType type);
+
+	void processVertices(const aiMesh* mesh, aiVector3D Zero3D, const aiMatrix4x4& transform);
+	void processBounds();
+	void processIndices(const aiMesh* mesh, bool mirrored);
+	void optimizeGeometry();
+	void processTopology();
+	void processOccluder();
 	void processTextures(const aiMaterial* material, const std::string& resPath);
 	void flatSetup();
-	void normalLinesSetup();
-	void averagedNormalsSetup(int meshNumber, std::string& file_start, std::string& numStr, std::string& file_end,
-	                          std::string& filename);
-	void smoothSetup(std::string& file_start, std::string numStr, std::string file_end, std::string& filename);
-	void processMesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath,const int meshNumber);
+	std::vector<float> buildSmoothVertices() const;
+	void smoothSetup();
+	// Derived buffers are built on a worker the first time they are drawn,
+	// these return true once the buffer is uploaded and can be drawn
+	bool collectJob(std::future<std::vector<float>>& job, std::vector<float>& target, std::vector<float> (Mesh::*build)() const);
+	bool ensureSmoothVertices();
+	bool buildSmoothVerticesOnGpu();
+	void processMesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath, const aiMatrix4x4& transform);
 
 public:
-	Mesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath,const int meshNumber);
-	void RenderFlat() const;
-	void RenderSmooth() const;
-	void RenderVertices() const;
-	void RenderTriangles() const;
-	void RenderFilledTriangles() const;
-	void RenderNormals() const;
-	void RenderAveragedNormals() const;
+	// Only builds CPU-side data, so meshes can be constructed on worker threads.
+	// The transform of the node placing the mesh is baked into the vertices.
+	Mesh(const aiMesh* mesh, const aiMaterial* material, const std::string& resPath, EResidencyPolicy residency = RESIDENCY_KEEP,
+		const aiMatrix4x4& transform = aiMatrix4x4());
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh(Mesh&& other) noexcept;
+	Mesh& operator=(Mesh&& other) noexcept;
+	~Mesh();
+	// Creates the GL objects, must run on the thread that owns the context
+	void Upload();
+	// Ranges for the model's multi-draws, Count is 0 before upload
+	DrawRange GetFlatDraw() const;
+	// Flat normals stand in until the smooth vertices are ready
+	DrawRange GetSmoothDraw();
+	// GL_LINES_ADJACENCY range of the unique edges over the flat vertices
+	DrawRange GetEdgeDraw() const;
+	unsigned GetEdgeCount() const;
+	unsigned GetTriangleCount() const;
+	// How the import reordering changed vertex cache misses
+	const VertexCacheStats& GetCacheStats() const;
+	const BoundingBox& GetBoundingBox() const;
+	const BoundingSphere& GetBoundingSphere() const;
+	const std::vector<glm::vec3>& GetOccluder() const;
+	// GL_POINTS ranges for drawing normals: every flat vertex, and the first
+	// smooth vertex of every welded position. Count is 0 while the smooth
+	// vertices are not ready.
+	DrawRange GetVertexDraw() const;
+	DrawRange GetWeldedVertexDraw();
+
+	// Images are owned by the model's texture atlas, the mesh only keeps its layers
+	const std::string& GetDiffusePath() const;
+	const std::string& GetSpecularPath() const;
+	void SetTextureSlots(AtlasSlot diffuse, AtlasSlot specular);
+	AtlasSlot GetDiffuseSlot() const;
+	AtlasSlot GetSpecularSlot() const;
+
+	// Applied after upload and whenever a derived buffer has been uploaded
+	void SetResidencyPolicy(EResidencyPolicy policy);
+	// These bring released data back from the compressed copy, the disk cache
+	// or the GPU, so they have to be called on the GL thread
+	const std::vector<float>& GetFlatVertices();
+	const std::vector<unsigned>& GetIndices();
+	const std::vector<float>& GetSmoothVertices();
+	size_t GetCpuBytes() const;
 };
@@ -0,0 +1,255 @@
+#include "mesh_cache.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char CACHE_MAGIC[8] = { 'O', 'G', 'L', 'T', 'M', 'E', 'S', 'H' };
+static const uint32_t CACHE_FORMAT_VERSION = 1;
+
+struct MeshCacheHeader {
+    char Magic[8];
+    uint32_t FormatVersion;
+    uint32_t AlgorithmVersion;
+    uint64_t SourceKey;
+    uint64_t FloatCount;
+    uint64_t PayloadHash;
+};
+
+static uint64_t
+fnv1a(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ull) {
+    const unsigned char* Bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= Bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static std::string
+entryPath(const std::string& kind, uint64_t sourceKey) {
+    char Hex[17];
+    std::snprintf(Hex, sizeof(Hex), "%016llx", static_cast<unsigned long long>(sourceKey));
+    return std::string(MESH_CACHE_DIRECTORY) + "/" + kind + "_" + Hex + ".bin";
+}
+
+namespace {
+
+class MappedFile {
+
+private:
+    const unsigned char* mData = nullptr;
+    size_t mSize = 0;
+#ifdef _WIN32
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    HANDLE mMapping = nullptr;
+#endif
+
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (mFile == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER FileSize;
+        if (!GetFileSizeEx(mFile, &FileSize) || FileSize.QuadPart == 0) return;
+        mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mMapping) return;
+        mData = static_cast<const unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+        mSize = mData ? static_cast<size_t>(FileSize.QuadPart) : 0;
+#else
+        int File = open(path.c_str(), O_RDONLY);
+        if (File < 0) return;
+        struct stat Info;
+        if (fstat(File, &Info) == 0 && Info.st_size > 0) {
+            void* Mapping = mmap(nullptr, static_cast<size_t>(Info.st_size), PROT_READ, MAP_PRIVATE, File, 0);
+            if (Mapping != MAP_FAILED) {
+                mData = static_cast<const unsigned char*>(Mapping);
+                mSize = static_cast<size_t>(Info.st_size);
+            }
+        }
+        close(File);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (mData) UnmapViewOfFile(mData);
+        if (mMapping) CloseHandle(mMapping);
+        if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+#else
+        if (mData) munmap(const_cast<unsigned char*>(mData), mSize);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* Data() const { return mData; }
+    size_t Size() const { return mSize; }
+};
+
+struct PendingWrite {
+    std::string Path;
+    MeshCacheHeader Header;
+    std::vector<float> Data;
+};
+
+// Serializes cache entries on its own thread so that a cache miss only costs
+// the computation, not the disk write.
+class WriteBehindQueue {
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mWakeUp;
+    std::condition_variable mDrained;
+    std::deque<PendingWrite> mPending;
+    bool mBusy = false;
+    bool mStop = false;
+    std::thread mWorker;
+
+    static void write(const PendingWrite& entry) {
+        std::error_code Error;
+        std::filesystem::create_directories(MESH_CACHE_DIRECTORY, Error);
+        const std::string TempPath = entry.Path + ".tmp";
+        {
+            std::ofstream Out(TempPath, std::ios::binary | std::ios::trunc);
+            if (!Out.is_open()) {
+                std::cerr << "Unable to save data to file: " << entry.Path << std::endl;
+                return;
+            }
+            Out.write(reinterpret_cast<const char*>(&entry.Header), sizeof(entry.Header));
+            Out.write(reinterpret_cast<const char*>(entry.Data.data()), entry.Data.size() * sizeof(float));
+        }
+        std::remove(entry.Path.c_str());
+        if (std::rename(TempPath.c_str(), entry.Path.c_str()) != 0) {
+            std::cerr << "Unable to save data to file: " << entry.Path << std::endl;
+            std::remove(TempPath.c_str());
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> Lock(mMutex);
+        for (;;) {
+            mWakeUp.wait(Lock, [this] { return mStop || !mPending.empty(); });
+            if (mPending.empty()) return;
+            PendingWrite Entry = std::move(mPending.front());
+            mPending.pop_front();
+            mBusy = true;
+            Lock.unlock();
+            write(Entry);
+            Lock.lock();
+            mBusy = false;
+            if (mPending.empty()) mDrained.notify_all();
+        }
+    }
+
+public:
+    WriteBehindQueue() : mWorker(&WriteBehindQueue::run, this) {}
+
+    ~WriteBehindQueue() {
+        {
+            std::lock_guard<std::mutex> Lock(mMutex);
+            mStop = true;
+        }
+        mWakeUp.notify_all();
+        mWorker.join();
+    }
+
+    void Push(PendingWrite entry) {
+        {
+            std::lock_guard<std::mutex> Lock(mMutex);
+            mPending.push_back(std::move(entry));
+        }
+        mWakeUp.notify_one();
+    }
+
+    void Drain() {
+        std::unique_lock<std::mutex> Lock(mMutex);
+        mDrained.wait(Lock, [this] { return mPending.empty() && !mBusy; });
+    }
+};
+
+WriteBehindQueue&
+writeBehindQueue() {
+    static WriteBehindQueue Queue;
+    return Queue;
+}
+
+}
+
+uint64_t
+MeshCache::HashSource(const std::vector<float>& vertices, float weldTolerance) {
+    const uint32_t AlgorithmVersion = MESH_CACHE_ALGORITHM_VERSION;
+    uint64_t Hash = fnv1a(&AlgorithmVersion, sizeof(AlgorithmVersion));
+    Hash = fnv1a(&weldTolerance, sizeof(weldTolerance), Hash);
+    return fnv1a(vertices.data(), vertices.size() * sizeof(float), Hash);
+}
+
+bool
+MeshCache::Load(const std::string& kind, uint64_t sourceKey, std::vector<float>& data) {
+    const std::string Path = entryPath(kind, sourceKey);
+    MappedFile File(Path);
+    if (!File.Data()) {
+        return false;
+    }
+
+    MeshCacheHeader Header;
+    if (File.Size() < sizeof(Header)) {
+        std::cerr << "Rebuilding stale mesh cache entry: " << Path << std::endl;
+        return false;
+    }
+    std::memcpy(&Header, File.Data(), sizeof(Header));
+    const unsigned char* Payload = File.Data() + sizeof(Header);
+    const size_t PayloadSize = File.Size() - sizeof(Header);
+    if (std::memcmp(Header.Magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+        || Header.FormatVersion != CACHE_FORMAT_VERSION
+        || Header.AlgorithmVersion != MESH_CACHE_ALGORITHM_VERSION
+        || Header.SourceKey != sourceKey
+        || Header.FloatCount * sizeof(float) != PayloadSize
+        || Header.PayloadHash != fnv1a(Payload, PayloadSize)) {
+        std::cerr << "Rebuilding stale mesh cache entry: " << Path << std::endl;
+        return false;
+    }
+
+    data.resize(static_cast<size_t>(Header.FloatCount));
+    if (PayloadSize) {
+        std::memcpy(data.data(), Payload, PayloadSize);
+    }
+    return true;
+}
+
+void
+MeshCache::Store(const std::string& kind, uint64_t sourceKey, const std::vector<float>& data) {
+    PendingWrite Entry;
+    Entry.Path = entryPath(kind, sourceKey);
+    std::memcpy(Entry.Header.Magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    Entry.Header.FormatVersion = CACHE_FORMAT_VERSION;
+    Entry.Header.AlgorithmVersion = MESH_CACHE_ALGORITHM_VERSION;
+    Entry.Header.SourceKey = sourceKey;
+    Entry.Header.FloatCount = data.size();
+    Entry.Header.PayloadHash = fnv1a(data.data(), data.size() * sizeof(float));
+    Entry.Data = data;
+    writeBehindQueue().Push(std::move(Entry));
+}
+
+void
+MeshCache::Flush() {
+    writeBehindQueue().Drain();
+}
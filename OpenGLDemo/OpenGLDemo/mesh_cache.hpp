@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define MESH_CACHE_DIRECTORY "mesh_data"
+// Bump whenever the data derived from a mesh changes for the same input
+#define MESH_CACHE_ALGORITHM_VERSION 1
+
+// Binary cache for per-mesh derived vertex data. Entries are addressed by a
+// hash of the source vertices, so they stay valid no matter in which model or
+// at which position a mesh is loaded. Reads map the file and copy the payload
+// as is, writes are handed to a background thread.
+class MeshCache {
+
+public:
+    static uint64_t HashSource(const std::vector<float>& vertices, float weldTolerance);
+    static bool Load(const std::string& kind, uint64_t sourceKey, std::vector<float>& data);
+    static void Store(const std::string& kind, uint64_t sourceKey, const std::vector<float>& data);
+    static void Flush();
+};
@@ -0,0 +1,238 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <glm/glm.hpp>
+
+void
+VertexCacheStats::Add(const VertexCacheStats& other) {
+    Triangles += other.Triangles;
+    MissesBefore += other.MissesBefore;
+    MissesTipsify += other.MissesTipsify;
+    MissesOverdraw += other.MissesOverdraw;
+    MissesFetch += other.MissesFetch;
+    Ms += other.Ms;
+}
+
+double
+VertexCacheStats::Acmr(unsigned misses, unsigned triangles) {
+    return triangles ? static_cast<double>(misses) / triangles : 0.0;
+}
+
+unsigned
+MeshOptimizer::CountCacheMisses(const std::vector<unsigned>& indices, unsigned vertexCount) {
+    // Time each vertex entered the cache, it is still there while fewer than
+    // VERTEX_CACHE_SIZE misses happened since
+    std::vector<unsigned> Entered(vertexCount, 0);
+    unsigned Misses = 0;
+    for (unsigned Index : indices) {
+        if (Entered[Index] && Misses - Entered[Index] < VERTEX_CACHE_SIZE) {
+            continue;
+        }
+        ++Misses;
+        Entered[Index] = Misses;
+    }
+    return Misses;
+}
+
+std::vector<unsigned>
+MeshOptimizer::tipsify(const std::vector<unsigned>& indices, unsigned vertexCount, std::vector<unsigned>& clusters) {
+    const unsigned TriangleCount = static_cast<unsigned>(indices.size() / 3);
+    // Triangles of every vertex
+    std::vector<unsigned> Start(vertexCount + 1, 0);
+    for (unsigned Index : indices) {
+        ++Start[Index + 1];
+    }
+    std::partial_sum(Start.begin(), Start.end(), Start.begin());
+    std::vector<unsigned> Adjacent(indices.size());
+    std::vector<unsigned> Next(Start.begin(), Start.end() - 1);
+    for (unsigned Corner = 0; Corner < indices.size(); ++Corner) {
+        Adjacent[Next[indices[Corner]]++] = Corner / 3;
+    }
+
+    std::vector<unsigned> Live(vertexCount);
+    for (unsigned Vertex = 0; Vertex < vertexCount; ++Vertex) {
+        Live[Vertex] = Start[Vertex + 1] - Start[Vertex];
+    }
+    std::vector<unsigned> CacheTime(vertexCount, 0);
+    std::vector<bool> Emitted(TriangleCount, false);
+    std::vector<unsigned> DeadEnds;
+    std::vector<unsigned> Candidates;
+    std::vector<unsigned> Result;
+    Result.reserve(indices.size());
+    unsigned Time = VERTEX_CACHE_SIZE + 1;
+    unsigned Cursor = 0;
+
+    auto SkipDeadEnd = [&]() -> int {
+        while (!DeadEnds.empty()) {
+            const unsigned Vertex = DeadEnds.back();
+            DeadEnds.pop_back();
+            if (Live[Vertex]) {
+                return static_cast<int>(Vertex);
+            }
+        }
+        for (; Cursor < vertexCount; ++Cursor) {
+            if (Live[Cursor]) {
+                return static_cast<int>(Cursor);
+            }
+        }
+        return -1;
+    };
+
+    clusters.clear();
+    int Fanning = SkipDeadEnd();
+    bool Jumped = true;
+    while (Fanning >= 0) {
+        if (Jumped) {
+            // The cache is probably cold again, which is where a cluster starts
+            clusters.push_back(static_cast<unsigned>(Result.size() / 3));
+        }
+        Candidates.clear();
+        for (unsigned Slot = Start[Fanning]; Slot < Start[Fanning + 1]; ++Slot) {
+            const unsigned Triangle = Adjacent[Slot];
+            if (Emitted[Triangle]) {
+                continue;
+            }
+            Emitted[Triangle] = true;
+            for (unsigned Corner = 0; Corner < 3; ++Corner) {
+                const unsigned Vertex = indices[Triangle * 3 + Corner];
+                Result.push_back(Vertex);
+                DeadEnds.push_back(Vertex);
+                Candidates.push_back(Vertex);
+                --Live[Vertex];
+                if (Time - CacheTime[Vertex] > VERTEX_CACHE_SIZE) {
+                    CacheTime[Vertex] = Time++;
+                }
+            }
+        }
+
+        // Prefer the candidate that stays in the cache longest while its
+        // remaining triangles are emitted
+        int Best = -1;
+        int BestPriority = -1;
+        for (unsigned Vertex : Candidates) {
+            if (!Live[Vertex]) {
+                continue;
+            }
+            int Priority = 0;
+            if (Time - CacheTime[Vertex] + 2 * Live[Vertex] <= VERTEX_CACHE_SIZE) {
+                Priority = static_cast<int>(Time - CacheTime[Vertex]);
+            }
+            if (Priority > BestPriority) {
+                BestPriority = Priority;
+                Best = static_cast<int>(Vertex);
+            }
+        }
+        Jumped = Best < 0;
+        Fanning = Jumped ? SkipDeadEnd() : Best;
+    }
+    clusters.push_back(TriangleCount);
+    return Result;
+}
+
+std::vector<unsigned>
+MeshOptimizer::sortClusters(const std::vector<unsigned>& indices, const std::vector<float>& vertices,
+    unsigned stride, const std::vector<unsigned>& clusters) {
+    auto Position = [&](unsigned Vertex) {
+        const float* Data = &vertices[static_cast<size_t>(Vertex) * stride];
+        return glm::vec3(Data[0], Data[1], Data[2]);
+    };
+
+    // Area weighted centroids and normals of the mesh and of every cluster
+    const unsigned ClusterCount = static_cast<unsigned>(clusters.size() - 1);
+    std::vector<glm::vec3> Centroids(ClusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> Normals(ClusterCount, glm::vec3(0.0f));
+    glm::vec3 MeshCentroid(0.0f);
+    float MeshArea = 0.0f;
+    for (unsigned Cluster = 0; Cluster < ClusterCount; ++Cluster) {
+        float Area = 0.0f;
+        for (unsigned Triangle = clusters[Cluster]; Triangle < clusters[Cluster + 1]; ++Triangle) {
+            const glm::vec3 A = Position(indices[Triangle * 3]);
+            const glm::vec3 B = Position(indices[Triangle * 3 + 1]);
+            const glm::vec3 C = Position(indices[Triangle * 3 + 2]);
+            // Twice the area, the factor cancels out
+            const glm::vec3 Normal = glm::cross(B - A, C - A);
+            const float TriangleArea = glm::length(Normal);
+            Centroids[Cluster] += TriangleArea * (A + B + C) / 3.0f;
+            Normals[Cluster] += Normal;
+            Area += TriangleArea;
+        }
+        MeshCentroid += Centroids[Cluster];
+        MeshArea += Area;
+        Centroids[Cluster] = Area > 0.0f ? Centroids[Cluster] / Area : Position(indices[clusters[Cluster] * 3]);
+    }
+    if (MeshArea > 0.0f) {
+        MeshCentroid /= MeshArea;
+    }
+
+    std::vector<float> Keys(ClusterCount);
+    for (unsigned Cluster = 0; Cluster < ClusterCount; ++Cluster) {
+        const float Length = glm::length(Normals[Cluster]);
+        Keys[Cluster] = Length > 0.0f ? glm::dot(Centroids[Cluster] - MeshCentroid, Normals[Cluster] / Length) : 0.0f;
+    }
+    std::vector<unsigned> Order(ClusterCount);
+    std::iota(Order.begin(), Order.end(), 0);
+    std::stable_sort(Order.begin(), Order.end(), [&](unsigned Left, unsigned Right) {
+        return Keys[Left] > Keys[Right];
+    });
+
+    std::vector<unsigned> Result;
+    Result.reserve(indices.size());
+    for (unsigned Cluster : Order) {
+        Result.insert(Result.end(), indices.begin() + clusters[Cluster] * 3, indices.begin() + clusters[Cluster + 1] * 3);
+    }
+    return Result;
+}
+
+void
+MeshOptimizer::reorderVertices(std::vector<float>& vertices, unsigned stride, std::vector<unsigned>& indices) {
+    const unsigned VertexCount = static_cast<unsigned>(vertices.size() / stride);
+    const unsigned Unused = 0xFFFFFFFF;
+    std::vector<unsigned> Remap(VertexCount, Unused);
+    unsigned NextVertex = 0;
+    for (unsigned& Index : indices) {
+        if (Remap[Index] == Unused) {
+            Remap[Index] = NextVertex++;
+        }
+        Index = Remap[Index];
+    }
+    for (unsigned& Target : Remap) {
+        if (Target == Unused) {
+            Target = NextVertex++;
+        }
+    }
+    std::vector<float> Reordered(vertices.size());
+    for (unsigned Vertex = 0; Vertex < VertexCount; ++Vertex) {
+        std::copy_n(vertices.begin() + static_cast<size_t>(Vertex) * stride, stride,
+            Reordered.begin() + static_cast<size_t>(Remap[Vertex]) * stride);
+    }
+    vertices.swap(Reordered);
+}
+
+VertexCacheStats
+MeshOptimizer::Optimize(std::vector<float>& vertices, unsigned stride, std::vector<unsigned>& indices) {
+    const auto StartTime = std::chrono::steady_clock::now();
+    const unsigned VertexCount = static_cast<unsigned>(vertices.size() / stride);
+    VertexCacheStats Stats;
+    Stats.Triangles = static_cast<unsigned>(indices.size() / 3);
+    Stats.MissesBefore = CountCacheMisses(indices, VertexCount);
+    if (!Stats.Triangles) {
+        return Stats;
+    }
+
+    std::vector<unsigned> Clusters;
+    std::vector<unsigned> Optimized = tipsify(indices, VertexCount, Clusters);
+    Stats.MissesTipsify = CountCacheMisses(Optimized, VertexCount);
+    Optimized = sortClusters(Optimized, vertices, stride, Clusters);
+    Stats.MissesOverdraw = CountCacheMisses(Optimized, VertexCount);
+    // Keep the file order if it was already better, as with meshes made for games
+    if (Stats.MissesOverdraw > Stats.MissesBefore) {
+        Optimized = indices;
+    }
+    reorderVertices(vertices, stride, Optimized);
+    Stats.MissesFetch = CountCacheMisses(Optimized, VertexCount);
+    indices.swap(Optimized);
+    Stats.Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+    return Stats;
+}
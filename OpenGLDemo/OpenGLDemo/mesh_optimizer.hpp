@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+// Entries of the simulated post-transform cache, small enough for any GPU
+#define VERTEX_CACHE_SIZE 16
+
+// Vertex cache misses of a triangle list after each step of the optimizer,
+// sums of these over meshes stay meaningful
+struct VertexCacheStats {
+    unsigned Triangles = 0;
+    unsigned MissesBefore = 0;
+    unsigned MissesTipsify = 0;
+    unsigned MissesOverdraw = 0;
+    unsigned MissesFetch = 0;
+    double Ms = 0.0;
+
+    void Add(const VertexCacheStats& other);
+    // Average cache misses per triangle
+    static double Acmr(unsigned misses, unsigned triangles);
+};
+
+// Reorders the triangles and vertices of an indexed triangle list without
+// changing what it draws. Tipsify (Sander, Nehab and Barczak 2007) orders
+// triangles for the post-transform cache and leaves clusters behind where it
+// had to jump, the clusters are then sorted so that those facing out of the
+// mesh come first, which draws surfaces likely to occlude the rest earlier
+// from most directions. Finally vertices are renumbered in order of first use
+// so fetches walk the vertex buffer forward. Vertices nothing refers to are
+// kept at the end.
+class MeshOptimizer {
+
+private:
+    static std::vector<unsigned> tipsify(const std::vector<unsigned>& indices, unsigned vertexCount, std::vector<unsigned>& clusters);
+    static std::vector<unsigned> sortClusters(const std::vector<unsigned>& indices, const std::vector<float>& vertices,
+        unsigned stride, const std::vector<unsigned>& clusters);
+    static void reorderVertices(std::vector<float>& vertices, unsigned stride, std::vector<unsigned>& indices);
+
+public:
+    // Vertices are interleaved with the position at offset 0
+    static VertexCacheStats Optimize(std::vector<float>& vertices, unsigned stride, std::vector<unsigned>& indices);
+    // FIFO cache like the hardware one, counts the vertices it had to transform
+    static unsigned CountCacheMisses(const std::vector<unsigned>& indices, unsigned vertexCount);
+};
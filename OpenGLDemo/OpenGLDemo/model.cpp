@@ -1,7 +1,107 @@
 #include "model.hpp"
 
-Model::Model(std::string filename) {
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <tuple>
+#include <unordered_map>
+#include "thread_pool.hpp"
+
+static constexpr UniformName U_DIFFUSE_ARRAY("uDiffuseArray");
+static constexpr UniformName U_SPECULAR_ARRAY("uSpecularArray");
+static constexpr UniformName U_DIFFUSE_LAYER("uDiffuseLayer");
+static constexpr UniformName U_SPECULAR_LAYER("uSpecularLayer");
+
+static glm::mat4
+toGlm(const aiMatrix4x4& matrix) {
+    // Assimp stores rows, glm columns
+    glm::mat4 Result;
+    for (unsigned Row = 0; Row < 4; ++Row) {
+        for (unsigned Column = 0; Column < 4; ++Column) {
+            Result[Column][Row] = matrix[Row][Column];
+        }
+    }
+    return Result;
+}
+
+// Box around the corners of a box after a transform
+static BoundingBox
+transformBox(const BoundingBox& box, const glm::mat4& matrix) {
+    BoundingBox Result;
+    for (unsigned CornerIdx = 0; CornerIdx < 8; ++CornerIdx) {
+        const glm::vec3 Corner((CornerIdx & 1) ? box.Max.x : box.Min.x, (CornerIdx & 2) ? box.Max.y : box.Min.y,
+            (CornerIdx & 4) ? box.Max.z : box.Min.z);
+        const glm::vec3 Transformed = glm::vec3(matrix * glm::vec4(Corner, 1.0f));
+        Result.Min = CornerIdx ? glm::min(Result.Min, Transformed) : Transformed;
+        Result.Max = CornerIdx ? glm::max(Result.Max, Transformed) : Transformed;
+    }
+    return Result;
+}
+
+// Every node that refers to a mesh places it once, with the accumulated node transforms
+static void
+collectPlacements(const aiNode* node, const aiMatrix4x4& parent, std::vector<std::vector<aiMatrix4x4>>& placements) {
+    const aiMatrix4x4 Transform = parent * node->mTransformation;
+    for (unsigned MeshIdx = 0; MeshIdx < node->mNumMeshes; ++MeshIdx) {
+        placements[node->mMeshes[MeshIdx]].push_back(Transform);
+    }
+    for (unsigned ChildIdx = 0; ChildIdx < node->mNumChildren; ++ChildIdx) {
+        collectPlacements(node->mChildren[ChildIdx], Transform, placements);
+    }
+}
+
+static uint64_t
+hashBytes(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* Bytes = static_cast<const unsigned char*>(data);
+    for (size_t Byte = 0; Byte < size; ++Byte) {
+        hash = (hash ^ Bytes[Byte]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Everything a Mesh is built from, so equal hashes are worth a full comparison
+static uint64_t
+hashGeometry(const aiMesh* mesh) {
+    uint64_t Hash = 0xCBF29CE484222325ull;
+    Hash = hashBytes(&mesh->mMaterialIndex, sizeof(mesh->mMaterialIndex), Hash);
+    Hash = hashBytes(mesh->mVertices, mesh->mNumVertices * sizeof(aiVector3D), Hash);
+    Hash = hashBytes(mesh->mNormals, mesh->mNumVertices * sizeof(aiVector3D), Hash);
+    if (mesh->HasTextureCoords(0)) {
+        Hash = hashBytes(mesh->mTextureCoords[0], mesh->mNumVertices * sizeof(aiVector3D), Hash);
+    }
+    for (unsigned FaceIdx = 0; FaceIdx < mesh->mNumFaces; ++FaceIdx) {
+        const aiFace& Face = mesh->mFaces[FaceIdx];
+        Hash = hashBytes(Face.mIndices, Face.mNumIndices * sizeof(unsigned), Hash);
+    }
+    return Hash;
+}
+
+static bool
+sameGeometry(const aiMesh* first, const aiMesh* second) {
+    if (first->mNumVertices != second->mNumVertices || first->mNumFaces != second->mNumFaces
+        || first->mMaterialIndex != second->mMaterialIndex || first->HasTextureCoords(0) != second->HasTextureCoords(0)) {
+        return false;
+    }
+    const size_t VertexBytes = first->mNumVertices * sizeof(aiVector3D);
+    if (std::memcmp(first->mVertices, second->mVertices, VertexBytes) || std::memcmp(first->mNormals, second->mNormals, VertexBytes)
+        || (first->HasTextureCoords(0) && std::memcmp(first->mTextureCoords[0], second->mTextureCoords[0], VertexBytes))) {
+        return false;
+    }
+    for (unsigned FaceIdx = 0; FaceIdx < first->mNumFaces; ++FaceIdx) {
+        const aiFace& FirstFace = first->mFaces[FaceIdx];
+        const aiFace& SecondFace = second->mFaces[FaceIdx];
+        if (FirstFace.mNumIndices != SecondFace.mNumIndices
+            || std::memcmp(FirstFace.mIndices, SecondFace.mIndices, FirstFace.mNumIndices * sizeof(unsigned))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Model::Model(std::string filename, EResidencyPolicy residency) {
     mFilename = filename;
+    mResidency = residency;
     mDirectory = filename.substr(0, filename.find_last_of('/'));
 }
 
@@ -14,65 +114,700 @@ Model::Load() {
         std::cerr << "[Err] Failed to load model:" << std::endl << Importer.GetErrorString() << std::endl;
         return false;
     }
-    mMeshes.reserve(Scene->mNumMeshes);
+    const auto StartTime = std::chrono::steady_clock::now();
+    std::vector<std::vector<aiMatrix4x4>> Placements(Scene->mNumMeshes);
+    collectPlacements(Scene->mRootNode, aiMatrix4x4(), Placements);
+    // Geometry that repeats under another aiMesh is placed through its first occurrence
+    std::vector<unsigned> Sources(Scene->mNumMeshes);
+    std::unordered_multimap<uint64_t, unsigned> Hashes;
+    mImportStats = { Scene->mNumMeshes, 0, 0, 0 };
+    for (unsigned MeshIdx = 0; MeshIdx < Scene->mNumMeshes; ++MeshIdx) {
+        const aiMesh* CurrAIMesh = Scene->mMeshes[MeshIdx];
+        // Meshes no node refers to are drawn where they are, as before
+        if (Placements[MeshIdx].empty()) {
+            Placements[MeshIdx].push_back(aiMatrix4x4());
+        }
+        mImportStats.Placements += static_cast<unsigned>(Placements[MeshIdx].size());
+        Sources[MeshIdx] = MeshIdx;
+        const uint64_t Hash = hashGeometry(CurrAIMesh);
+        const auto Candidates = Hashes.equal_range(Hash);
+        for (auto It = Candidates.first; It != Candidates.second; ++It) {
+            if (sameGeometry(Scene->mMeshes[It->second], CurrAIMesh)) {
+                Sources[MeshIdx] = It->second;
+                break;
+            }
+        }
+        if (Sources[MeshIdx] == MeshIdx) {
+            Hashes.emplace(Hash, MeshIdx);
+            continue;
+        }
+        std::vector<aiMatrix4x4>& SourcePlacements = Placements[Sources[MeshIdx]];
+        SourcePlacements.insert(SourcePlacements.end(), Placements[MeshIdx].begin(), Placements[MeshIdx].end());
+        mImportStats.DedupedBytes += static_cast<size_t>(CurrAIMesh->mNumVertices) * 8 * sizeof(float);
+        for (unsigned FaceIdx = 0; FaceIdx < CurrAIMesh->mNumFaces; ++FaceIdx) {
+            mImportStats.DedupedBytes += CurrAIMesh->mFaces[FaceIdx].mNumIndices * sizeof(unsigned);
+        }
+    }
+
+    // Workers hand over the built mesh through a pointer, so no Mesh is ever
+    // moved from or destroyed off the GL thread
+    std::vector<std::future<std::unique_ptr<Mesh>>> PendingMeshes;
+    PendingMeshes.reserve(Scene->mNumMeshes);
+    mRepeats.clear();
+    mRepeatRanges.clear();
+    mRepeatsUploaded = false;
     for(unsigned MeshIdx = 0; MeshIdx < Scene->mNumMeshes; ++MeshIdx) {
-        aiMesh* CurrAIMesh = Scene->mMeshes[MeshIdx];
-        Mesh CurrMesh(CurrAIMesh, Scene->mMaterials[CurrAIMesh->mMaterialIndex], mDirectory, MeshIdx+1);
-        mMeshes.push_back(CurrMesh);
+        if (Sources[MeshIdx] != MeshIdx) {
+            continue;
+        }
+        const aiMesh* CurrAIMesh = Scene->mMeshes[MeshIdx];
+        const aiMaterial* CurrMaterial = Scene->mMaterials[CurrAIMesh->mMaterialIndex];
+        const std::string& Directory = mDirectory;
+        const EResidencyPolicy Residency = mResidency;
+        const std::vector<aiMatrix4x4>& MeshPlacements = Placements[MeshIdx];
+        const aiMatrix4x4 First = MeshPlacements[0];
+        PendingMeshes.push_back(ThreadPool::Shared().Submit([CurrAIMesh, CurrMaterial, &Directory, Residency, First] {
+            return std::make_unique<Mesh>(CurrAIMesh, CurrMaterial, Directory, Residency, First);
+        }));
+        // A repeat mirrors relative to the first placement when exactly one of them is mirrored
+        const glm::mat4 FromFirst = glm::inverse(toGlm(First));
+        const bool FirstMirrored = First.Determinant() < 0.0f;
+        for (const bool Mirrored : { false, true }) {
+            RepeatRange Repeats = { static_cast<unsigned>(PendingMeshes.size() - 1), static_cast<unsigned>(mRepeats.size()), 0, Mirrored };
+            for (size_t Placement = 1; Placement < MeshPlacements.size(); ++Placement) {
+                if (((MeshPlacements[Placement].Determinant() < 0.0f) != FirstMirrored) == Mirrored) {
+                    mRepeats.push_back(toGlm(MeshPlacements[Placement]) * FromFirst);
+                    ++Repeats.Count;
+                }
+            }
+            if (Repeats.Count) {
+                mRepeatRanges.push_back(Repeats);
+            }
+        }
+    }
+
+    // Collect in submission order so mesh order does not depend on scheduling
+    mMeshes.reserve(PendingMeshes.size());
+    for (std::future<std::unique_ptr<Mesh>>& PendingMesh : PendingMeshes) {
+        mMeshes.push_back(std::move(*PendingMesh.get()));
+        mMeshes.back().Upload();
+    }
+    mImportStats.UniqueMeshes = static_cast<unsigned>(mMeshes.size());
+    buildBounds();
+    buildGpuRecords();
 
+    const bool Textured = std::any_of(mMeshes.begin(), mMeshes.end(), [](const Mesh& CurrMesh) {
+        return !CurrMesh.GetDiffusePath().empty() || !CurrMesh.GetSpecularPath().empty();
+    });
+    if (Textured) {
+        mAtlas = std::make_unique<TextureAtlas>();
+        for (const Mesh& CurrMesh : mMeshes) {
+            mAtlas->Add(CurrMesh.GetDiffusePath());
+            mAtlas->Add(CurrMesh.GetSpecularPath());
+        }
+        // Meshes draw the placeholder layer until Update hands out the slots
+        mAtlas->Build();
     }
-    std::cout << mFilename << " Loaded " << mMeshes.size() << " meshes" << std::endl;
+    const auto LoadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime);
+    std::cout << mFilename << " Loaded " << mMeshes.size() << " meshes in " << LoadTime.count() << " ms on "
+              << ThreadPool::Shared().GetThreadCount() << " threads, " << GetCpuBytes() / 1024 << " KiB kept in memory" << std::endl;
+    const VertexCacheStats CacheStats = GetCacheStats();
+    std::cout << mFilename << " ACMR " << VertexCacheStats::Acmr(CacheStats.MissesBefore, CacheStats.Triangles)
+              << " -> " << VertexCacheStats::Acmr(CacheStats.MissesTipsify, CacheStats.Triangles) << " (vertex cache) -> "
+              << VertexCacheStats::Acmr(CacheStats.MissesOverdraw, CacheStats.Triangles) << " (overdraw) -> "
+              << VertexCacheStats::Acmr(CacheStats.MissesFetch, CacheStats.Triangles) << " (vertex fetch), "
+              << CacheStats.Ms << " ms over all meshes" << std::endl;
+    std::cout << mFilename << " " << mImportStats.Placements << " mesh placements of " << mImportStats.SourceMeshes << " meshes drawn from "
+              << mImportStats.UniqueMeshes << " unique meshes, " << mImportStats.DedupedBytes / 1024 << " KiB of vertex and index data deduplicated"
+              << std::endl;
     return true;
 }
 
 void
-Model::RenderFlat() {
-    for(unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
-        Mesh &Mesh = mMeshes[MeshIdx];
-        mMeshes[MeshIdx].RenderFlat();
+Model::Unload() {
+    mMeshes.clear();
+    mRepeats.clear();
+    mRepeatRanges.clear();
+    mRepeatBuffer.Release();
+    mTexturedOrder.clear();
+    mRepeatsUploaded = false;
+    mRepeatPass = false;
+    buildBounds();
+    buildGpuRecords();
+    mAtlas.reset();
+}
+
+void
+Model::SetResidencyPolicy(EResidencyPolicy policy) {
+    mResidency = policy;
+    for (Mesh& CurrMesh : mMeshes) {
+        CurrMesh.SetResidencyPolicy(policy);
     }
 }
 
+EResidencyPolicy
+Model::GetResidencyPolicy() const {
+    return mResidency;
+}
+
+size_t
+Model::GetCpuBytes() const {
+    size_t Bytes = 0;
+    for (const Mesh& CurrMesh : mMeshes) {
+        Bytes += CurrMesh.GetCpuBytes();
+    }
+    return Bytes;
+}
 
 void
-Model::RenderSmooth() {
+Model::buildBounds() {
+    std::vector<BoundingBox> Boxes;
+    Boxes.reserve(mMeshes.size());
+    for (const Mesh& CurrMesh : mMeshes) {
+        Boxes.push_back(CurrMesh.GetBoundingBox());
+    }
+    mCuller.Build(Boxes);
+    mVisible.assign(mMeshes.size(), 1);
+    mOccluded.assign(mMeshes.size(), 0);
+    std::vector<BoundingBox> RepeatBoxes(mRepeats.size());
+    for (const RepeatRange& Repeats : mRepeatRanges) {
+        for (unsigned RepeatIdx = Repeats.First; RepeatIdx < Repeats.First + Repeats.Count; ++RepeatIdx) {
+            RepeatBoxes[RepeatIdx] = transformBox(Boxes[Repeats.MeshIdx], mRepeats[RepeatIdx]);
+        }
+    }
+    mRepeatCuller.Build(RepeatBoxes);
+    mRepeatVisible.assign(mRepeats.size(), 1);
+    mBox = BoundingBox();
+    mSphere = BoundingSphere();
+    if (Boxes.empty()) {
+        return;
+    }
+    // Sphere around the mesh spheres, for rejecting the whole model at once
+    BoundingBox Total = Boxes[0];
+    for (const std::vector<BoundingBox>* Group : { &Boxes, &RepeatBoxes }) {
+        for (const BoundingBox& Box : *Group) {
+            Total.Min = glm::min(Total.Min, Box.Min);
+            Total.Max = glm::max(Total.Max, Box.Max);
+        }
+    }
+    mBox = Total;
+    mSphere.Center = 0.5f * (Total.Min + Total.Max);
+    mSphere.Radius = 0.0f;
+    for (const Mesh& CurrMesh : mMeshes) {
+        const BoundingSphere& Sphere = CurrMesh.GetBoundingSphere();
+        mSphere.Radius = std::max(mSphere.Radius, glm::length(Sphere.Center - mSphere.Center) + Sphere.Radius);
+    }
+    // Repeats can be scaled, the sphere around their box is safe for any transform
+    for (const BoundingBox& Box : RepeatBoxes) {
+        const float Radius = 0.5f * glm::length(Box.Max - Box.Min);
+        mSphere.Radius = std::max(mSphere.Radius, glm::length(0.5f * (Box.Min + Box.Max) - mSphere.Center) + Radius);
+    }
+}
+
+bool
+Model::isVisible(size_t meshIdx, bool filled) const {
+    return !mCulling || (mVisible[meshIdx] && !(filled && mOccluded[meshIdx]));
+}
+
+GpuCullRecord
+Model::gpuRecord(unsigned meshIdx, const DrawRange& smooth) const {
+    const Mesh& CurrMesh = mMeshes[meshIdx];
+    const DrawRange Flat = CurrMesh.GetFlatDraw();
+    const BoundingBox& Box = CurrMesh.GetBoundingBox();
+    return { glm::vec4(Box.Min, 1.0f), glm::vec4(Box.Max, 1.0f), static_cast<GLuint>(Flat.Count), Flat.FirstIndex,
+        Flat.BaseVertex, smooth.BaseVertex };
+}
+
+void
+Model::buildGpuRecords() {
+    mGpuCuller.reset();
+    mPendingSmooth.clear();
+    if (mMeshes.empty() || !GpuCuller::IsAvailable()) {
+        return;
+    }
+    // Smooth vertices are built on first use, until then the flat ones stand in
+    std::vector<GpuCullRecord> Records;
+    Records.reserve(mMeshes.size());
     for (unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
-        Mesh& Mesh = mMeshes[MeshIdx];
-        mMeshes[MeshIdx].RenderSmooth();
+        Records.push_back(gpuRecord(MeshIdx, mMeshes[MeshIdx].GetFlatDraw()));
+        mPendingSmooth.push_back(MeshIdx);
     }
+    mGpuCuller = std::make_unique<GpuCuller>();
+    mGpuCuller->Build(Records);
+}
+
+bool
+Model::usesGpuCulling() const {
+    return mCulling && mGpuCulling && mGpuCuller;
+}
+
+bool
+Model::submitIndirect(GLenum mode, bool smooth) {
+    if (smooth && !mPendingSmooth.empty()) {
+        auto Ready = std::remove_if(mPendingSmooth.begin(), mPendingSmooth.end(), [&](unsigned MeshIdx) {
+            const DrawRange Smooth = mMeshes[MeshIdx].GetSmoothDraw();
+            if (Smooth.BaseVertex == mMeshes[MeshIdx].GetFlatDraw().BaseVertex) {
+                return false;
+            }
+            mGpuCuller->UpdateRecord(MeshIdx, gpuRecord(MeshIdx, Smooth));
+            return true;
+        });
+        mPendingSmooth.erase(Ready, mPendingSmooth.end());
+    }
+    if (!mGpuCuller->Cull(Frustum(mCullMatrix), smooth)) {
+        ++mGpuCullStats.Fallbacks;
+        return false;
+    }
+    ++mGpuCullStats.Dispatches;
+    mGpuCuller->Draw(mode);
+    return true;
 }
 
 void
-Model::RenderVertices() {
-    for(unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
-        Mesh &Mesh = mMeshes[MeshIdx];
-        mMeshes[MeshIdx].RenderVertices();
+Model::SetGpuCulling(bool culling) {
+    mGpuCulling = culling;
+}
+
+bool
+Model::IsGpuCulling() const {
+    return mGpuCulling;
+}
+
+GpuCullStats
+Model::GetGpuCullStats() const {
+    return mGpuCullStats;
+}
+
+const BoundingBox&
+Model::GetBoundingBox() const {
+    return mBox;
+}
+
+void
+Model::Cull(const glm::mat4& modelViewProjection) {
+    // Repeats are culled here in every mode, and uploaded again with the new visible set
+    const Frustum ViewFrustum(modelViewProjection);
+    mRepeatCuller.Cull(ViewFrustum, mRepeatVisible);
+    mRepeatsUploaded = false;
+    // The GPU culler only replaces the draw lists of the passes that go
+    // through submit. Every other pass, and submit when the shader is not
+    // usable, still draws from the CPU stages below.
+    mCullMatrix = modelViewProjection;
+    mGpuCullStats = { 0, usesGpuCulling() ? mGpuCuller->GetRecordCount() : 0, 0 };
+    if (!mCulling) {
+        mCullStats = { static_cast<unsigned>(mMeshes.size()), 0 };
+        return;
+    }
+    if (!ViewFrustum.Intersects(mSphere)) {
+        std::fill(mVisible.begin(), mVisible.end(), 0);
     }
+    else {
+        mCuller.Cull(ViewFrustum, mVisible);
+    }
+    const unsigned InFrustum = static_cast<unsigned>(std::count(mVisible.begin(), mVisible.end(), 1));
+    std::fill(mOccluded.begin(), mOccluded.end(), 0);
+    if (mOcclusionCulling) {
+        cullOccluded(modelViewProjection);
+    }
+    mCullStats.Culled = static_cast<unsigned>(mVisible.size()) - InFrustum;
+    mCullStats.Visible = InFrustum - static_cast<unsigned>(std::count(mOccluded.begin(), mOccluded.end(), 1));
 }
+
 void
-Model::RenderTriangles() {
-    for(unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
-        Mesh &Mesh = mMeshes[MeshIdx];
-        mMeshes[MeshIdx].RenderTriangles();
+Model::cullOccluded(const glm::mat4& modelViewProjection) {
+    if (!mOcclusion) {
+        mOcclusion = std::make_unique<OcclusionCuller>();
     }
-}void
-Model::RenderFilledTriangles() {
-    for(unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
-        Mesh &Mesh = mMeshes[MeshIdx];
-        mMeshes[MeshIdx].RenderFilledTriangles();
+    // Radius over clip w approximates the size on screen
+    const glm::vec4 DepthRow(modelViewProjection[0][3], modelViewProjection[1][3], modelViewProjection[2][3], modelViewProjection[3][3]);
+    mOccluders.clear();
+    for (unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
+        if (!mVisible[MeshIdx] || mMeshes[MeshIdx].GetOccluder().empty()) {
+            continue;
+        }
+        const BoundingSphere& Sphere = mMeshes[MeshIdx].GetBoundingSphere();
+        const float W = glm::dot(DepthRow, glm::vec4(Sphere.Center, 1.0f));
+        mOccluders.emplace_back(Sphere.Radius / std::max(W, 1e-3f), MeshIdx);
+    }
+    const size_t OccluderCount = std::min<size_t>(mOccluders.size(), OCCLUSION_MAX_OCCLUDERS);
+    std::partial_sort(mOccluders.begin(), mOccluders.begin() + OccluderCount, mOccluders.end(),
+        std::greater<std::pair<float, unsigned>>());
+
+    mOcclusion->Begin(modelViewProjection);
+    for (size_t Rank = 0; Rank < OccluderCount; ++Rank) {
+        mOcclusion->AddOccluder(mMeshes[mOccluders[Rank].second].GetOccluder());
+    }
+    mOcclusion->Rasterize();
+    // A mesh never hides itself, its surface is never nearer than its box
+    for (unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
+        mOccluded[MeshIdx] = mVisible[MeshIdx] && mOcclusion->IsOccluded(mMeshes[MeshIdx].GetBoundingBox());
+    }
+}
+
+void
+Model::SetOcclusionCulling(bool culling) {
+    mOcclusionCulling = culling;
+}
+
+bool
+Model::IsOcclusionCulling() const {
+    return mOcclusionCulling;
+}
+
+OcclusionStats
+Model::GetOcclusionStats() const {
+    return mOcclusion && mCulling && mOcclusionCulling ? mOcclusion->GetStats() : OcclusionStats{ 0, 0, 0, 0.0 };
+}
+
+void
+Model::SetCulling(bool culling) {
+    mCulling = culling;
+}
+
+bool
+Model::IsCulling() const {
+    return mCulling;
+}
+
+CullStats
+Model::GetCullStats() const {
+    return mCullStats;
+}
+
+void
+Model::uploadRepeats(const glm::mat4& modelMatrix) {
+    mRepeatTransforms.clear();
+    mRepeatDraws.clear();
+    for (const RepeatRange& Repeats : mRepeatRanges) {
+        RepeatRange Draw = { Repeats.MeshIdx, static_cast<unsigned>(mRepeatTransforms.size()), 0, Repeats.Mirrored };
+        for (unsigned RepeatIdx = Repeats.First; RepeatIdx < Repeats.First + Repeats.Count; ++RepeatIdx) {
+            if (mCulling && !mRepeatVisible[RepeatIdx]) {
+                continue;
+            }
+            mRepeatTransforms.push_back(modelMatrix * mRepeats[RepeatIdx]);
+            ++Draw.Count;
+        }
+        if (Draw.Count) {
+            mRepeatDraws.push_back(Draw);
+        }
+    }
+    mRepeatBuffer.Upload(mRepeatTransforms);
+}
+
+// Mirrored repeats wind their triangles clockwise, they are drawn with the
+// front face flipped so face culling keeps their outside
+template <typename Draw>
+void
+Model::drawRepeats(const Draw& draw) {
+    for (const RepeatRange& Repeats : mRepeatDraws) {
+        if (Repeats.Mirrored) {
+            glFrontFace(GL_CW);
+        }
+        draw(mMeshes[Repeats.MeshIdx], Repeats.First, static_cast<GLsizei>(Repeats.Count));
+        if (Repeats.Mirrored) {
+            glFrontFace(GL_CCW);
+        }
+    }
+}
+
+void
+Model::submit(GLenum mode, bool smooth) {
+    if (mRepeatPass) {
+        drawRepeats([&](Mesh& CurrMesh, unsigned First, GLsizei Count) {
+            const DrawRange Range = smooth ? CurrMesh.GetSmoothDraw() : CurrMesh.GetFlatDraw();
+            GeometryArena::DrawInstanced(mode, &Range, Range.Count ? 1 : 0, mRepeatBuffer.GetBuffer(), First, Count);
+        });
+        return;
+    }
+    if (usesGpuCulling() && submitIndirect(mode, smooth)) {
+        return;
+    }
+    mDraws.clear();
+    for (size_t MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
+        if (!isVisible(MeshIdx, mode == GL_TRIANGLES)) {
+            continue;
+        }
+        Mesh& CurrMesh = mMeshes[MeshIdx];
+        const DrawRange Range = smooth ? CurrMesh.GetSmoothDraw() : CurrMesh.GetFlatDraw();
+        if (Range.Count) {
+            mDraws.push_back(Range);
+        }
+    }
+    GeometryArena::MultiDraw(mode, mDraws.data(), static_cast<GLsizei>(mDraws.size()));
+}
+
+unsigned
+Model::GetEdgeCount() const {
+    unsigned Edges = 0;
+    for (const Mesh& CurrMesh : mMeshes) {
+        Edges += CurrMesh.GetEdgeCount();
+    }
+    return Edges;
+}
+
+unsigned
+Model::GetTriangleCount() const {
+    unsigned Triangles = 0;
+    for (const Mesh& CurrMesh : mMeshes) {
+        Triangles += CurrMesh.GetTriangleCount();
+    }
+    return Triangles;
+}
+
+VertexCacheStats
+Model::GetCacheStats() const {
+    VertexCacheStats Stats;
+    for (const Mesh& CurrMesh : mMeshes) {
+        Stats.Add(CurrMesh.GetCacheStats());
+    }
+    return Stats;
+}
+
+void
+Model::RenderFlat() {
+    submit(GL_TRIANGLES, false);
+}
+
+void
+Model::RenderSmooth() {
+    submit(GL_TRIANGLES, true);
+}
+
+void
+Model::RenderVertices() {
+    submit(GL_POINTS, false);
+}
+
+void
+Model::RenderEdges() {
+    if (mRepeatPass) {
+        drawRepeats([&](Mesh& CurrMesh, unsigned First, GLsizei Count) {
+            const DrawRange Range = CurrMesh.GetEdgeDraw();
+            GeometryArena::DrawInstanced(GL_LINES_ADJACENCY, &Range, Range.Count ? 1 : 0, mRepeatBuffer.GetBuffer(), First, Count);
+        });
+        return;
+    }
+    mDraws.clear();
+    for (size_t MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
+        if (!isVisible(MeshIdx, false)) {
+            continue;
+        }
+        const DrawRange Range = mMeshes[MeshIdx].GetEdgeDraw();
+        if (Range.Count) {
+            mDraws.push_back(Range);
+        }
     }
+    GeometryArena::MultiDraw(GL_LINES_ADJACENCY, mDraws.data(), static_cast<GLsizei>(mDraws.size()));
+}
+
+void
+Model::RenderFilledTriangles() {
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    submit(GL_TRIANGLES, false);
 }
+
 void
 Model::RenderNormals() {
-    for(unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
-        Mesh &Mesh = mMeshes[MeshIdx];
-        mMeshes[MeshIdx].RenderNormals();
+    if (mRepeatPass) {
+        drawRepeats([&](Mesh& CurrMesh, unsigned First, GLsizei Count) {
+            const DrawRange Range = CurrMesh.GetVertexDraw();
+            GeometryArena::DrawArraysInstanced(GL_POINTS, &Range, Range.Count ? 1 : 0, mRepeatBuffer.GetBuffer(), First, Count);
+        });
+        return;
+    }
+    mDraws.clear();
+    for (size_t MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
+        if (!isVisible(MeshIdx, false)) {
+            continue;
+        }
+        const DrawRange Range = mMeshes[MeshIdx].GetVertexDraw();
+        if (Range.Count) {
+            mDraws.push_back(Range);
+        }
     }
+    GeometryArena::MultiDrawArrays(GL_POINTS, mDraws.data(), static_cast<GLsizei>(mDraws.size()));
 }
+
 void
 Model::RenderAveragedNormals() {
-    for(unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
-        Mesh &Mesh = mMeshes[MeshIdx];
-        mMeshes[MeshIdx].RenderAveragedNormals();
+    // Meshes whose smooth vertices are not ready yet draw nothing
+    if (mRepeatPass) {
+        drawRepeats([&](Mesh& CurrMesh, unsigned First, GLsizei Count) {
+            const DrawRange Range = CurrMesh.GetWeldedVertexDraw();
+            GeometryArena::DrawInstanced(GL_POINTS, &Range, Range.Count ? 1 : 0, mRepeatBuffer.GetBuffer(), First, Count);
+        });
+        return;
+    }
+    mDraws.clear();
+    for (size_t MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
+        if (!isVisible(MeshIdx, false)) {
+            continue;
+        }
+        const DrawRange Range = mMeshes[MeshIdx].GetWeldedVertexDraw();
+        if (Range.Count) {
+            mDraws.push_back(Range);
+        }
+    }
+    GeometryArena::MultiDraw(GL_POINTS, mDraws.data(), static_cast<GLsizei>(mDraws.size()));
+}
+
+void
+Model::Update() {
+    if (mAtlas && mAtlas->Update()) {
+        for (Mesh& CurrMesh : mMeshes) {
+            CurrMesh.SetTextureSlots(mAtlas->Find(CurrMesh.GetDiffusePath()), mAtlas->Find(CurrMesh.GetSpecularPath()));
+        }
+        // Meshes with the same arrays and layers end up next to each other,
+        // so each distinct pair is one multi-draw whatever the import order
+        mTexturedOrder.resize(mMeshes.size());
+        for (unsigned MeshIdx = 0; MeshIdx < mMeshes.size(); ++MeshIdx) {
+            mTexturedOrder[MeshIdx] = MeshIdx;
+        }
+        std::stable_sort(mTexturedOrder.begin(), mTexturedOrder.end(), [this](unsigned First, unsigned Second) {
+            const AtlasSlot FirstDiffuse = mMeshes[First].GetDiffuseSlot();
+            const AtlasSlot FirstSpecular = mMeshes[First].GetSpecularSlot();
+            const AtlasSlot SecondDiffuse = mMeshes[Second].GetDiffuseSlot();
+            const AtlasSlot SecondSpecular = mMeshes[Second].GetSpecularSlot();
+            return std::tie(FirstDiffuse.Array, FirstSpecular.Array, FirstDiffuse.Layer, FirstSpecular.Layer)
+                < std::tie(SecondDiffuse.Array, SecondSpecular.Array, SecondDiffuse.Layer, SecondSpecular.Layer);
+        });
+    }
+}
+
+bool
+Model::HasTextures() const {
+    return mAtlas != nullptr;
+}
+
+void
+Model::RenderTextured(const Shader& shader) {
+    if (!mAtlas) {
+        return;
+    }
+    shader.Bind();
+    shader.SetUniform1i(U_DIFFUSE_ARRAY, 0);
+    shader.SetUniform1i(U_SPECULAR_ARRAY, 1);
+    if (mRepeatPass) {
+        drawRepeats([&](Mesh& CurrMesh, unsigned First, GLsizei Count) {
+            const AtlasSlot Diffuse = CurrMesh.GetDiffuseSlot();
+            const AtlasSlot Specular = CurrMesh.GetSpecularSlot();
+            mAtlas->Bind(Diffuse.Array, 0);
+            mAtlas->Bind(Specular.Array, 1);
+            shader.SetUniform1i(U_DIFFUSE_LAYER, Diffuse.Layer);
+            shader.SetUniform1i(U_SPECULAR_LAYER, Specular.Layer);
+            const DrawRange Range = CurrMesh.GetSmoothDraw();
+            GeometryArena::DrawInstanced(GL_TRIANGLES, &Range, Range.Count ? 1 : 0, mRepeatBuffer.GetBuffer(), First, Count);
+        });
+        glActiveTexture(GL_TEXTURE0);
+        return;
+    }
+    // Meshes go in the order sorted by layers, each run with the same layers
+    // is one multi-draw and arrays are only rebound when the run uses images
+    // of another size. Before the atlas is ready every mesh has the same slots.
+    int BoundDiffuse = -2;
+    int BoundSpecular = -2;
+    mDraws.clear();
+    const bool Sorted = mTexturedOrder.size() == mMeshes.size();
+    for (size_t OrderIdx = 0; OrderIdx < mMeshes.size(); ++OrderIdx) {
+        const size_t MeshIdx = Sorted ? mTexturedOrder[OrderIdx] : OrderIdx;
+        Mesh& CurrMesh = mMeshes[MeshIdx];
+        if (isVisible(MeshIdx, true)) {
+            const DrawRange Range = CurrMesh.GetSmoothDraw();
+            if (Range.Count) {
+                mDraws.push_back(Range);
+            }
+        }
+        const AtlasSlot Diffuse = CurrMesh.GetDiffuseSlot();
+        const AtlasSlot Specular = CurrMesh.GetSpecularSlot();
+        if (OrderIdx + 1 < mMeshes.size()) {
+            const Mesh& NextMesh = mMeshes[Sorted ? mTexturedOrder[OrderIdx + 1] : OrderIdx + 1];
+            const AtlasSlot NextDiffuse = NextMesh.GetDiffuseSlot();
+            const AtlasSlot NextSpecular = NextMesh.GetSpecularSlot();
+            if (NextDiffuse.Array == Diffuse.Array && NextDiffuse.Layer == Diffuse.Layer
+                && NextSpecular.Array == Specular.Array && NextSpecular.Layer == Specular.Layer) {
+                continue;
+            }
+        }
+        if (mDraws.empty()) {
+            continue;
+        }
+        if (Diffuse.Array != BoundDiffuse) {
+            mAtlas->Bind(Diffuse.Array, 0);
+            BoundDiffuse = Diffuse.Array;
+        }
+        if (Specular.Array != BoundSpecular) {
+            mAtlas->Bind(Specular.Array, 1);
+            BoundSpecular = Specular.Array;
+        }
+        shader.SetUniform1i(U_DIFFUSE_LAYER, Diffuse.Layer);
+        shader.SetUniform1i(U_SPECULAR_LAYER, Specular.Layer);
+        GeometryArena::MultiDraw(GL_TRIANGLES, mDraws.data(), static_cast<GLsizei>(mDraws.size()));
+        mDraws.clear();
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void
+Model::RenderInstanced(const InstanceGrid& grid, bool smooth) {
+    mDraws.clear();
+    for (Mesh& CurrMesh : mMeshes) {
+        const DrawRange Range = smooth ? CurrMesh.GetSmoothDraw() : CurrMesh.GetFlatDraw();
+        if (Range.Count) {
+            mDraws.push_back(Range);
+        }
+    }
+    const GLsizei InstanceCount = static_cast<GLsizei>(grid.GetVisibleCount());
+    GeometryArena::DrawInstanced(GL_TRIANGLES, mDraws.data(), static_cast<GLsizei>(mDraws.size()), grid.GetBuffer(), 0, InstanceCount);
+    // Each repeat is one more draw over the grid instances, composed with them
+    // in the shader, so the CPU work does not grow with the instance count
+    for (const RepeatRange& Repeats : mRepeatRanges) {
+        Mesh& CurrMesh = mMeshes[Repeats.MeshIdx];
+        const DrawRange Range = smooth ? CurrMesh.GetSmoothDraw() : CurrMesh.GetFlatDraw();
+        if (!Range.Count || !InstanceCount) {
+            continue;
+        }
+        if (Repeats.Mirrored) {
+            glFrontFace(GL_CW);
+        }
+        for (unsigned RepeatIdx = Repeats.First; RepeatIdx < Repeats.First + Repeats.Count; ++RepeatIdx) {
+            GeometryArena::DrawInstanced(GL_TRIANGLES, &Range, 1, grid.GetBuffer(), 0, InstanceCount, &mRepeats[RepeatIdx][0][0]);
+        }
+        if (Repeats.Mirrored) {
+            glFrontFace(GL_CCW);
+        }
     }
 }
+
+bool
+Model::BeginRepeats(const glm::mat4& modelMatrix) {
+    if (mRepeats.empty()) {
+        return false;
+    }
+    if (!mRepeatsUploaded || modelMatrix != mRepeatMatrix) {
+        uploadRepeats(modelMatrix);
+        mRepeatMatrix = modelMatrix;
+        mRepeatsUploaded = true;
+    }
+    mRepeatPass = !mRepeatDraws.empty();
+    return mRepeatPass;
+}
+
+void
+Model::EndRepeats() {
+    mRepeatPass = false;
+}
+
+unsigned
+Model::GetRepeatCount() const {
+    return static_cast<unsigned>(mRepeats.size());
+}
+
+const ImportStats&
+Model::GetImportStats() const {
+    return mImportStats;
+}
+
+const TextureAtlas*
+Model::GetAtlas() const {
+    return mAtlas.get();
+}
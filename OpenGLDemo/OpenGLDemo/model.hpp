@@ -6,15 +6,24 @@
 #include <algorithm>
 #include <vector>
 #include <iostream>
+#include <memory>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "shader.hpp"
 #include "mesh.hpp"
+#include "occlusion_culler.hpp"
+#include "gpu_culler.hpp"
+#include "instance_grid.hpp"
+#include "instance_buffer.hpp"
 
 #define POSITION_LOCATION 0
 #define NORMAL_LOCATION 1
-#define POSTPROCESS_FLAGS (aiProcess_Triangulate)
+// The OBJ importer emits one vertex per face corner, joining identical ones
+// gives the vertex cache optimization shared vertices to work with
+#define POSTPROCESS_FLAGS (aiProcess_Triangulate | aiProcess_JoinIdenticalVertices)
 #define INVALID_MATERIAL 0xFFFFFFFF
+// Meshes rasterized as occluders per frame, the ones largest on screen
+#define OCCLUSION_MAX_OCCLUDERS 64
 
 enum EBufferType {
 	INDEX_BUFFER = 0,
@@ -24,22 +33,143 @@ enum EBufferType {
 	BUFFER_COUNT = 4,
 };
 
+// How node placements of the imported meshes were turned into meshes and instances
+struct ImportStats {
+	unsigned SourceMeshes;
+	unsigned Placements;
+	unsigned UniqueMeshes;
+	size_t DedupedBytes;
+};
+
 class Model {
 private:
+	// Placements of a mesh after its first, as a range of mRepeats. Mirrored
+	// ones wind their triangles the other way and get a range of their own.
+	struct RepeatRange {
+		unsigned MeshIdx;
+		unsigned First;
+		unsigned Count;
+		bool Mirrored;
+	};
+
 	std::vector<Mesh> mMeshes;
+	EResidencyPolicy mResidency;
+	std::unique_ptr<TextureAtlas> mAtlas;
+	// Mesh indices sorted by atlas slots once the atlas is ready
+	std::vector<unsigned> mTexturedOrder;
+	// Reused every frame so drawing does not allocate
+	std::vector<DrawRange> mDraws;
+	// Meshes outside the frustum given to Cull are left out of every draw
+	FrustumCuller mCuller;
+	std::vector<unsigned char> mVisible;
+	// Meshes hidden behind others, only left out of passes that draw filled
+	// triangles since points and lines of them show through
+	std::vector<unsigned char> mOccluded;
+	BoundingBox mBox;
+	BoundingSphere mSphere;
+	bool mCulling = true;
+	CullStats mCullStats = { 0, 0 };
+	// Meshes left after frustum culling are tested against the largest of them
+	std::unique_ptr<OcclusionCuller> mOcclusion;
+	bool mOcclusionCulling = true;
+	std::vector<std::pair<float, unsigned>> mOccluders;
+	// Culling and draw submission on the GPU for the passes that go through
+	// submit, the CPU stages still run for every other pass
+	std::unique_ptr<GpuCuller> mGpuCuller;
+	bool mGpuCulling = true;
+	glm::mat4 mCullMatrix = glm::mat4(1.0f);
+	GpuCullStats mGpuCullStats = { 0, 0, 0 };
+	// Meshes whose smooth vertices the GPU records do not point at yet
+	std::vector<unsigned> mPendingSmooth;
+	// The first placement of a mesh is baked into its vertices, the others are
+	// kept relative to it and drawn instanced from one copy of the geometry
+	std::vector<glm::mat4> mRepeats;
+	std::vector<RepeatRange> mRepeatRanges;
+	// Boxes of the repeats in model space, culled like the meshes
+	FrustumCuller mRepeatCuller;
+	std::vector<unsigned char> mRepeatVisible;
+	// Transforms of the repeats drawn, and their ranges of mRepeatBuffer
+	std::vector<glm::mat4> mRepeatTransforms;
+	std::vector<RepeatRange> mRepeatDraws;
+	InstanceBuffer mRepeatBuffer;
+	glm::mat4 mRepeatMatrix = glm::mat4(1.0f);
+	bool mRepeatsUploaded = false;
+	bool mRepeatPass = false;
+	ImportStats mImportStats = { 0, 0, 0, 0 };
+
+	void buildBounds();
+	void cullOccluded(const glm::mat4& modelViewProjection);
+	void buildGpuRecords();
+	GpuCullRecord gpuRecord(unsigned meshIdx, const DrawRange& smooth) const;
+	bool usesGpuCulling() const;
+	bool submitIndirect(GLenum mode, bool smooth);
+	bool isVisible(size_t meshIdx, bool filled) const;
+	void submit(GLenum mode, bool smooth);
+	void uploadRepeats(const glm::mat4& modelMatrix);
+	template <typename Draw>
+	void drawRepeats(const Draw& draw);
 
 public:
 	std::string mFilename;
 	std::string mDirectory;
-	Model(std::string filename);
+	Model(std::string filename, EResidencyPolicy residency = RESIDENCY_KEEP);
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+	Model(Model&&) = default;
+	Model& operator=(Model&&) = default;
 	bool Load();
+	void Unload();
+	void SetResidencyPolicy(EResidencyPolicy policy);
+	EResidencyPolicy GetResidencyPolicy() const;
+	size_t GetCpuBytes() const;
+	unsigned GetEdgeCount() const;
+	unsigned GetTriangleCount() const;
+	VertexCacheStats GetCacheStats() const;
+	// Frustum culling against the planes of the combined matrix, once per frame
+	// before rendering
+	void Cull(const glm::mat4& modelViewProjection);
+	void SetCulling(bool culling);
+	bool IsCulling() const;
+	CullStats GetCullStats() const;
+	void SetOcclusionCulling(bool culling);
+	bool IsOcclusionCulling() const;
+	OcclusionStats GetOcclusionStats() const;
+	// Needs GL 4.3, falls back to the CPU stages when that is missing
+	void SetGpuCulling(bool culling);
+	bool IsGpuCulling() const;
+	GpuCullStats GetGpuCullStats() const;
+	// Model space box around all meshes
+	const BoundingBox& GetBoundingBox() const;
 	void RenderFlat();
 	void RenderSmooth();
 	void RenderVertices();
-	void RenderTriangles();
+	// Unique edges as GL_LINES_ADJACENCY, for a geometry shader that drops
+	// the edges of back faces
+	void RenderEdges();
 	void RenderFilledTriangles();
+	// Vertices as GL_POINTS, for a geometry shader that expands each into its normal
 	void RenderNormals();
 	void RenderAveragedNormals();
+	// Finishes work streamed in the background, call once per frame on the GL thread
+	void Update();
+	// True when any mesh has a material texture, RenderTextured draws nothing otherwise
+	bool HasTextures() const;
+	// Smooth shading with the diffuse and specular images of every mesh taken
+	// from the texture arrays on units 0 and 1
+	void RenderTextured(const Shader& shader);
+	const TextureAtlas* GetAtlas() const;
+	// Every mesh once per visible instance of the grid, repeats included, for
+	// shaders built with USE_INSTANCING. Instances are culled by the grid, not
+	// per mesh, and each repeat is a draw over all of them.
+	void RenderInstanced(const InstanceGrid& grid, bool smooth);
+	// Between these calls the Render calls draw the further placements of
+	// meshes that occur more than once instead of the first ones, instanced
+	// and for shaders built with USE_INSTANCING. Begin returns false when
+	// there are none.
+	bool BeginRepeats(const glm::mat4& modelMatrix);
+	void EndRepeats();
+	unsigned GetRepeatCount() const;
+	const ImportStats& GetImportStats() const;
 
 };
 
@@ -0,0 +1,170 @@
+#include "occlusion_culler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <xmmintrin.h>
+#include "thread_pool.hpp"
+
+// Clip w below this counts as crossing the near plane
+#define OCCLUSION_MIN_W 1e-4f
+
+OcclusionCuller::OcclusionCuller()
+    : mDepth(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 0.0f) {
+}
+
+void
+OcclusionCuller::Begin(const glm::mat4& modelViewProjection) {
+    mViewProjection = modelViewProjection;
+    std::fill(mDepth.begin(), mDepth.end(), 0.0f);
+    mScreen.clear();
+    mStats = { 0, 0, 0, 0.0 };
+}
+
+void
+OcclusionCuller::AddOccluder(const std::vector<glm::vec3>& triangles) {
+    const auto StartTime = std::chrono::steady_clock::now();
+    for (size_t Corner = 0; Corner + 2 < triangles.size(); Corner += 3) {
+        glm::vec3 Projected[3];
+        bool Clipped = false;
+        for (unsigned Vertex = 0; Vertex < 3 && !Clipped; ++Vertex) {
+            const glm::vec4 Clip = mViewProjection * glm::vec4(triangles[Corner + Vertex], 1.0f);
+            Clipped = Clip.w < OCCLUSION_MIN_W;
+            const float InvW = 1.0f / Clip.w;
+            // Pixel centers sit at whole coordinates
+            Projected[Vertex] = glm::vec3((Clip.x * InvW * 0.5f + 0.5f) * OCCLUSION_WIDTH - 0.5f,
+                (Clip.y * InvW * 0.5f + 0.5f) * OCCLUSION_HEIGHT - 0.5f, InvW);
+        }
+        if (!Clipped) {
+            mScreen.insert(mScreen.end(), Projected, Projected + 3);
+        }
+    }
+    mStats.OccluderTriangles = static_cast<unsigned>(mScreen.size() / 3);
+    mStats.Ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+}
+
+void
+OcclusionCuller::rasterizeBand(unsigned firstRow, unsigned endRow) {
+    const __m128 LaneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    for (size_t Corner = 0; Corner < mScreen.size(); Corner += 3) {
+        glm::vec3 A = mScreen[Corner];
+        glm::vec3 B = mScreen[Corner + 1];
+        glm::vec3 C = mScreen[Corner + 2];
+        float Area = (B.x - A.x) * (C.y - A.y) - (B.y - A.y) * (C.x - A.x);
+        if (Area == 0.0f) {
+            continue;
+        }
+        // Both sides occlude, so wind every triangle the same way
+        if (Area < 0.0f) {
+            std::swap(B, C);
+            Area = -Area;
+        }
+        const int MinX = std::max(0, static_cast<int>(std::ceil(std::min({ A.x, B.x, C.x }))));
+        const int MaxX = std::min(OCCLUSION_WIDTH - 1, static_cast<int>(std::floor(std::max({ A.x, B.x, C.x }))));
+        const int MinY = std::max(static_cast<int>(firstRow), static_cast<int>(std::ceil(std::min({ A.y, B.y, C.y }))));
+        const int MaxY = std::min(static_cast<int>(endRow) - 1, static_cast<int>(std::floor(std::max({ A.y, B.y, C.y }))));
+        if (MinX > MaxX || MinY > MaxY) {
+            continue;
+        }
+
+        // Edge functions and 1 / w as planes over the screen: value = X * x + Y * y + Base
+        const float Edge0X = B.y - C.y, Edge0Y = C.x - B.x, Edge0Base = B.x * C.y - B.y * C.x;
+        const float Edge1X = C.y - A.y, Edge1Y = A.x - C.x, Edge1Base = C.x * A.y - C.y * A.x;
+        const float Edge2X = A.y - B.y, Edge2Y = B.x - A.x, Edge2Base = A.x * B.y - A.y * B.x;
+        const float DepthX = (Edge0X * A.z + Edge1X * B.z + Edge2X * C.z) / Area;
+        const float DepthY = (Edge0Y * A.z + Edge1Y * B.z + Edge2Y * C.z) / Area;
+        const float DepthBase = (Edge0Base * A.z + Edge1Base * B.z + Edge2Base * C.z) / Area;
+
+        const int FirstColumn = MinX & ~3;
+        const __m128 Zero = _mm_setzero_ps();
+        for (int Y = MinY; Y <= MaxY; ++Y) {
+            const float RowY = static_cast<float>(Y);
+            float* Row = &mDepth[static_cast<size_t>(Y) * OCCLUSION_WIDTH];
+            for (int X = FirstColumn; X <= MaxX; X += 4) {
+                const __m128 Column = _mm_add_ps(_mm_set1_ps(static_cast<float>(X)), LaneOffsets);
+                const __m128 Edge0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Edge0X), Column), _mm_set1_ps(Edge0Y * RowY + Edge0Base));
+                const __m128 Edge1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Edge1X), Column), _mm_set1_ps(Edge1Y * RowY + Edge1Base));
+                const __m128 Edge2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Edge2X), Column), _mm_set1_ps(Edge2Y * RowY + Edge2Base));
+                const __m128 Inside = _mm_and_ps(_mm_cmpge_ps(Edge0, Zero), _mm_and_ps(_mm_cmpge_ps(Edge1, Zero), _mm_cmpge_ps(Edge2, Zero)));
+                if (!_mm_movemask_ps(Inside)) {
+                    continue;
+                }
+                const __m128 Depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(DepthX), Column), _mm_set1_ps(DepthY * RowY + DepthBase));
+                const __m128 Stored = _mm_loadu_ps(Row + X);
+                const __m128 Nearer = _mm_max_ps(Stored, Depth);
+                _mm_storeu_ps(Row + X, _mm_or_ps(_mm_and_ps(Inside, Nearer), _mm_andnot_ps(Inside, Stored)));
+            }
+        }
+    }
+}
+
+void
+OcclusionCuller::Rasterize() {
+    const auto StartTime = std::chrono::steady_clock::now();
+    const unsigned RowsPerBand = (OCCLUSION_HEIGHT + OCCLUSION_BANDS - 1) / OCCLUSION_BANDS;
+    // Runs every frame, so the bands go through the pool's allocation free path
+    ThreadPool::Shared().ParallelFor(OCCLUSION_BANDS, [this, RowsPerBand](unsigned Band) {
+        const unsigned FirstRow = std::min(Band * RowsPerBand, static_cast<unsigned>(OCCLUSION_HEIGHT));
+        rasterizeBand(FirstRow, std::min(FirstRow + RowsPerBand, static_cast<unsigned>(OCCLUSION_HEIGHT)));
+    });
+    mStats.Ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+}
+
+bool
+OcclusionCuller::IsOccluded(const BoundingBox& box) {
+    const auto StartTime = std::chrono::steady_clock::now();
+    ++mStats.Tested;
+    float MinX = static_cast<float>(OCCLUSION_WIDTH);
+    float MaxX = -1.0f;
+    float MinY = static_cast<float>(OCCLUSION_HEIGHT);
+    float MaxY = -1.0f;
+    float NearestInvW = 0.0f;
+    bool Visible = false;
+    for (unsigned CornerIdx = 0; CornerIdx < 8 && !Visible; ++CornerIdx) {
+        const glm::vec3 Corner((CornerIdx & 1) ? box.Max.x : box.Min.x, (CornerIdx & 2) ? box.Max.y : box.Min.y,
+            (CornerIdx & 4) ? box.Max.z : box.Min.z);
+        const glm::vec4 Clip = mViewProjection * glm::vec4(Corner, 1.0f);
+        if (Clip.w < OCCLUSION_MIN_W) {
+            Visible = true;
+            break;
+        }
+        const float InvW = 1.0f / Clip.w;
+        const float X = (Clip.x * InvW * 0.5f + 0.5f) * OCCLUSION_WIDTH - 0.5f;
+        const float Y = (Clip.y * InvW * 0.5f + 0.5f) * OCCLUSION_HEIGHT - 0.5f;
+        MinX = std::min(MinX, X);
+        MaxX = std::max(MaxX, X);
+        MinY = std::min(MinY, Y);
+        MaxY = std::max(MaxY, Y);
+        NearestInvW = std::max(NearestInvW, InvW);
+    }
+
+    // Every pixel touched by the box rectangle, whole groups of four wide
+    const int FirstX = std::max(0, static_cast<int>(std::floor(MinX))) & ~3;
+    const int LastX = std::min(OCCLUSION_WIDTH - 1, static_cast<int>(std::ceil(MaxX)));
+    const int FirstY = std::max(0, static_cast<int>(std::floor(MinY)));
+    const int LastY = std::min(OCCLUSION_HEIGHT - 1, static_cast<int>(std::ceil(MaxY)));
+    // Boxes off screen are left to the frustum culler
+    Visible = Visible || FirstX > LastX || FirstY > LastY;
+    const __m128 Nearest = _mm_set1_ps(NearestInvW);
+    for (int Y = FirstY; Y <= LastY && !Visible; ++Y) {
+        const float* Row = &mDepth[static_cast<size_t>(Y) * OCCLUSION_WIDTH];
+        for (int X = FirstX; X <= LastX && !Visible; X += 4) {
+            Visible = _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(Row + X), Nearest)) != 0;
+        }
+    }
+    if (!Visible) {
+        ++mStats.Occluded;
+    }
+    mStats.Ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+    return !Visible;
+}
+
+const std::vector<float>&
+OcclusionCuller::GetDepth() const {
+    return mDepth;
+}
+
+OcclusionStats
+OcclusionCuller::GetStats() const {
+    return mStats;
+}
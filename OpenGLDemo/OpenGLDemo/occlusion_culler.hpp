@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "frustum.hpp"
+
+// Low resolution is enough to find large hidden meshes, width is a multiple of four
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+// Horizontal bands rasterized in parallel
+#define OCCLUSION_BANDS 4
+
+struct OcclusionStats {
+    unsigned OccluderTriangles;
+    unsigned Tested;
+    unsigned Occluded;
+    double Ms;
+};
+
+// Software occlusion culling without any GPU feedback. Occluder triangles are
+// rasterized into a small depth buffer on the thread pool, one band of rows
+// per job, four pixels at a time with SSE. The buffer holds the reciprocal of
+// the clip w, which interpolates linearly on screen, and keeps the nearest
+// occluder. A box is hidden when every pixel it covers holds an occluder
+// nearer than the nearest corner of the box. Anything crossing the near plane
+// is left out of the occluders and counts as visible, so mistakes only ever
+// keep meshes.
+class OcclusionCuller {
+
+private:
+    std::vector<float> mDepth;
+    // Projected occluder vertices as screen x, y and 1 / w
+    std::vector<glm::vec3> mScreen;
+    glm::mat4 mViewProjection = glm::mat4(1.0f);
+    OcclusionStats mStats = { 0, 0, 0, 0.0 };
+
+    void rasterizeBand(unsigned firstRow, unsigned endRow);
+
+public:
+    OcclusionCuller();
+    // Clears the depth buffer for a new frame
+    void Begin(const glm::mat4& modelViewProjection);
+    // Model space triangles, three positions each
+    void AddOccluder(const std::vector<glm::vec3>& triangles);
+    // Rasterizes everything added since Begin
+    void Rasterize();
+    bool IsOccluded(const BoundingBox& box);
+    const std::vector<float>& GetDepth() const;
+    OcclusionStats GetStats() const;
+};
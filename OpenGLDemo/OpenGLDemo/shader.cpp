@@ -1,88 +1,537 @@
 #include "shader.hpp"
 
-Shader::Shader(const std::string& vShaderPath, const std::string& fShaderPath) {
-    unsigned vs = loadAndCompileShader(vShaderPath, GL_VERTEX_SHADER);
-    unsigned fs = loadAndCompileShader(fShaderPath, GL_FRAGMENT_SHADER);
-    mId = createBasicProgram(vs, fs);
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include "uniform_buffer.hpp"
+
+static constexpr UniformName U_MODEL("uModel");
+static constexpr UniformName U_VIEW("uView");
+static constexpr UniformName U_PROJECTION("uProjection");
+
+static const char PROGRAM_CACHE_MAGIC[8] = { 'O', 'G', 'L', 'T', 'P', 'R', 'O', 'G' };
+
+struct ProgramCacheHeader {
+    char Magic[8];
+    uint32_t Format;
+    uint32_t Length;
+    uint64_t Key;
+    double CompileMs;
+};
+
+unsigned Shader::sBoundProgram = 0;
+UniformStats Shader::sStats = { 0, 0 };
+ShaderStartupReport Shader::sReport = { 0, 0, 0, 0, 0.0, 0.0, 0.0 };
+
+static uint64_t
+fnv1a(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ull) {
+    const unsigned char* Bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= Bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static uint64_t
+fnv1a(const char* text, uint64_t hash) {
+    // The terminator separates consecutive strings
+    return fnv1a(text ? text : "", text ? std::strlen(text) + 1 : 1, hash);
+}
+
+static double
+millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool
+programBinariesSupported() {
+    if (!GLEW_ARB_get_program_binary) {
+        return false;
+    }
+    int FormatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &FormatCount);
+    return FormatCount > 0;
+}
+
+static void
+enableParallelCompile() {
+    static bool Enabled = false;
+    if (!Enabled && GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    }
+    Enabled = true;
+}
+
+static std::string
+programCachePath(uint64_t key) {
+    char Hex[17];
+    std::snprintf(Hex, sizeof(Hex), "%016llx", static_cast<unsigned long long>(key));
+    return std::string(SHADER_CACHE_DIRECTORY) + "/" + Hex + ".bin";
+}
+
+Shader::Shader(const std::string& vShaderPath, const std::string& fShaderPath, const std::vector<std::string>& defines)
+    : Shader(vShaderPath, "", fShaderPath, defines) {
+}
+
+Shader::Shader(const std::string& vShaderPath, const std::string& gShaderPath, const std::string& fShaderPath, const std::vector<std::string>& defines) {
+    mId = 0;
+    mVertexShader = 0;
+    mGeometryShader = 0;
+    mFragmentShader = 0;
+    mLinked = false;
+    mVertexPath = vShaderPath;
+    mGeometryPath = gShaderPath;
+    mFragmentPath = fShaderPath;
+    const auto StartTime = std::chrono::steady_clock::now();
+
+    // Binaries are only valid for the driver that produced them
+    const std::string VertexSource = readSource(vShaderPath, defines);
+    const std::string GeometrySource = gShaderPath.empty() ? std::string() : readSource(gShaderPath, defines);
+    const std::string FragmentSource = readSource(fShaderPath, defines);
+    mCacheKey = fnv1a(VertexSource.c_str(), 0xCBF29CE484222325ull);
+    mCacheKey = fnv1a(GeometrySource.c_str(), mCacheKey);
+    mCacheKey = fnv1a(FragmentSource.c_str(), mCacheKey);
+    mCacheKey = fnv1a(reinterpret_cast<const char*>(glGetString(GL_VENDOR)), mCacheKey);
+    mCacheKey = fnv1a(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), mCacheKey);
+    mCacheKey = fnv1a(reinterpret_cast<const char*>(glGetString(GL_VERSION)), mCacheKey);
+
+    if (loadBinary()) {
+        sReport.Cached++;
+        sReport.LoadMs += millisecondsSince(StartTime);
+        return;
+    }
+
+    // With KHR_parallel_shader_compile these return immediately and the
+    // driver compiles in the background until the program is first used
+    enableParallelCompile();
+    mVertexShader = compileShader(VertexSource, GL_VERTEX_SHADER);
+    if (!gShaderPath.empty()) {
+        mGeometryShader = compileShader(GeometrySource, GL_GEOMETRY_SHADER);
+    }
+    mFragmentShader = compileShader(FragmentSource, GL_FRAGMENT_SHADER);
+    mIssueMs = millisecondsSince(StartTime);
+    sReport.Pending++;
 }
 
 unsigned
 Shader::GetId() const {
+    ensureLinked();
     return mId;
 }
 
 void
-Shader::SetUniform1i(const std::string& uniform, int v) const {
-    glUniform1i(glGetUniformLocation(mId, uniform.c_str()), v);
+Shader::Bind() const {
+    ensureLinked();
+    if (sBoundProgram != mId) {
+        glUseProgram(mId);
+        sBoundProgram = mId;
+    }
 }
 
 void
-Shader::SetUniform1f(const std::string& uniform, float v) const {
-    glUniform1f(glGetUniformLocation(mId, uniform.c_str()), v);
+Shader::Unbind() {
+    glUseProgram(0);
+    sBoundProgram = 0;
+}
+
+unsigned
+Shader::GetBoundProgram() {
+    return sBoundProgram;
 }
 
 void
-Shader::SetUniform3f(const std::string& uniform, const glm::vec3& v) const {
-    glUniform3f(glGetUniformLocation(mId, uniform.c_str()), v.x, v.y, v.z);
+Shader::UseProgram(unsigned program) {
+    if (sBoundProgram != program) {
+        glUseProgram(program);
+        sBoundProgram = program;
+    }
 }
 
 void
-Shader::SetUniform4m(const std::string& uniform, const glm::mat4& m) const {
-    glUniformMatrix4fv(glGetUniformLocation(mId, uniform.c_str()), 1, GL_FALSE, &m[0][0]);
+Shader::SetUniform1i(const UniformName& uniform, int v) const {
+    UniformSlot* Slot = findUniform(uniform);
+    if (Slot && changeUniform(*Slot, &v, sizeof(v))) {
+        glUniform1i(Slot->Location, v);
+    }
+}
+
+void
+Shader::SetUniform1f(const UniformName& uniform, float v) const {
+    UniformSlot* Slot = findUniform(uniform);
+    if (Slot && changeUniform(*Slot, &v, sizeof(v))) {
+        glUniform1f(Slot->Location, v);
+    }
+}
+
+void
+Shader::SetUniform2f(const UniformName& uniform, const glm::vec2& v) const {
+    UniformSlot* Slot = findUniform(uniform);
+    if (Slot && changeUniform(*Slot, &v[0], sizeof(float) * 2)) {
+        glUniform2f(Slot->Location, v.x, v.y);
+    }
+}
+
+void
+Shader::SetUniform3f(const UniformName& uniform, const glm::vec3& v) const {
+    UniformSlot* Slot = findUniform(uniform);
+    if (Slot && changeUniform(*Slot, &v[0], sizeof(float) * 3)) {
+        glUniform3f(Slot->Location, v.x, v.y, v.z);
+    }
+}
+
+void
+Shader::SetUniform4m(const UniformName& uniform, const glm::mat4& m) const {
+    UniformSlot* Slot = findUniform(uniform);
+    if (Slot && changeUniform(*Slot, &m[0][0], sizeof(float) * 16)) {
+        glUniformMatrix4fv(Slot->Location, 1, GL_FALSE, &m[0][0]);
+    }
 }
 
 void
 Shader::SetModel(const glm::mat4& m) const {
-    SetUniform4m("uModel", m);
+    SetUniform4m(U_MODEL, m);
 }
 
 void
 Shader::SetView(const glm::mat4& m) const {
-    SetUniform4m("uView", m);
+    SetUniform4m(U_VIEW, m);
 }
 
 void Shader::SetProjection(const glm::mat4& m) const {
-    SetUniform4m("uProjection", m);
+    SetUniform4m(U_PROJECTION, m);
 }
 
-unsigned
-Shader::loadAndCompileShader(std::string filename, GLuint shaderType) {
-    unsigned ShaderID = 0;
+UniformStats
+Shader::GetUniformStats() {
+    return sStats;
+}
+
+void
+Shader::ResetUniformStats() {
+    sStats = { 0, 0 };
+}
+
+ShaderStartupReport
+Shader::GetStartupReport() {
+    return sReport;
+}
+
+void
+Shader::ensureLinked() const {
+    if (mLinked) {
+        return;
+    }
+    mLinked = true;
+    const auto StartTime = std::chrono::steady_clock::now();
+    const bool VertexOk = checkShader(mVertexShader, GL_VERTEX_SHADER, mVertexPath);
+    const bool GeometryOk = !mGeometryShader || checkShader(mGeometryShader, GL_GEOMETRY_SHADER, mGeometryPath);
+    const bool FragmentOk = checkShader(mFragmentShader, GL_FRAGMENT_SHADER, mFragmentPath);
+    if (VertexOk && GeometryOk && FragmentOk) {
+        mId = createBasicProgram(mVertexShader, mGeometryShader, mFragmentShader);
+    }
+    else {
+        glDeleteShader(mVertexShader);
+        glDeleteShader(mGeometryShader);
+        glDeleteShader(mFragmentShader);
+    }
+    mVertexShader = 0;
+    mGeometryShader = 0;
+    mFragmentShader = 0;
+
+    const double CompileMs = mIssueMs + millisecondsSince(StartTime);
+    sReport.Pending--;
+    if (!mId) {
+        sReport.Failed++;
+        return;
+    }
+    sReport.Compiled++;
+    sReport.CompileMs += CompileMs;
+    introspectUniforms();
+    bindUniformBlocks();
+    saveBinary(CompileMs);
+}
+
+bool
+Shader::loadBinary() {
+    if (!programBinariesSupported()) {
+        return false;
+    }
+    std::ifstream In(programCachePath(mCacheKey), std::ios::binary);
+    if (!In.is_open()) {
+        return false;
+    }
+    ProgramCacheHeader Header;
+    In.read(reinterpret_cast<char*>(&Header), sizeof(Header));
+    if (!In || std::memcmp(Header.Magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0 || Header.Key != mCacheKey) {
+        return false;
+    }
+    std::vector<char> Binary(Header.Length);
+    In.read(Binary.data(), Binary.size());
+    if (!In) {
+        return false;
+    }
+
+    // Drivers reject binaries after an update, which just means compiling again
+    unsigned ProgramID = glCreateProgram();
+    glProgramBinary(ProgramID, Header.Format, Binary.data(), static_cast<GLsizei>(Binary.size()));
+    int Success = 0;
+    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Success);
+    if (!Success) {
+        glDeleteProgram(ProgramID);
+        return false;
+    }
+
+    mId = ProgramID;
+    mLinked = true;
+    sReport.SavedMs += Header.CompileMs;
+    introspectUniforms();
+    bindUniformBlocks();
+    return true;
+}
+
+void
+Shader::saveBinary(double compileMs) const {
+    if (!programBinariesSupported()) {
+        return;
+    }
+    int Length = 0;
+    glGetProgramiv(mId, GL_PROGRAM_BINARY_LENGTH, &Length);
+    if (Length <= 0) {
+        return;
+    }
+    std::vector<char> Binary(Length);
+    GLenum Format = 0;
+    glGetProgramBinary(mId, Length, &Length, &Format, Binary.data());
+
+    ProgramCacheHeader Header;
+    std::memcpy(Header.Magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+    Header.Format = Format;
+    Header.Length = static_cast<uint32_t>(Length);
+    Header.Key = mCacheKey;
+    Header.CompileMs = compileMs;
+
+    std::error_code Error;
+    std::filesystem::create_directories(SHADER_CACHE_DIRECTORY, Error);
+    std::ofstream Out(programCachePath(mCacheKey), std::ios::binary | std::ios::trunc);
+    if (!Out.is_open()) {
+        std::cerr << "Unable to save data to file: " << programCachePath(mCacheKey) << std::endl;
+        return;
+    }
+    Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+    Out.write(Binary.data(), Length);
+}
+
+void
+Shader::introspectUniforms() const {
+    int Count = 0;
+    int MaxLength = 0;
+    glGetProgramiv(mId, GL_ACTIVE_UNIFORMS, &Count);
+    glGetProgramiv(mId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &MaxLength);
+
+    std::vector<char> Name(MaxLength + 1);
+    std::vector<std::string> Names;
+    for (int i = 0; i < Count; ++i) {
+        int Length = 0;
+        int Size = 0;
+        GLenum Type = 0;
+        glGetActiveUniform(mId, i, MaxLength + 1, &Length, &Size, &Type, Name.data());
+        std::string UniformString(Name.data(), Length);
+        // Arrays are reported as "name[0]", their first element is set by plain name
+        if (UniformString.size() > 3 && UniformString.compare(UniformString.size() - 3, 3, "[0]") == 0) {
+            UniformString.resize(UniformString.size() - 3);
+        }
+        // Members of uniform blocks have no location
+        const int Location = glGetUniformLocation(mId, UniformString.c_str());
+        if (Location < 0) {
+            continue;
+        }
+        UniformSlot Slot = {};
+        Slot.Hash = UniformName(UniformString.c_str()).mHash;
+        Slot.Location = Location;
+        Slot.Type = Type;
+        mUniforms.push_back(Slot);
+        Names.push_back(UniformString);
+    }
+
+    std::vector<unsigned> Order(mUniforms.size());
+    for (unsigned i = 0; i < Order.size(); ++i) {
+        Order[i] = i;
+    }
+    std::sort(Order.begin(), Order.end(), [this](unsigned a, unsigned b) { return mUniforms[a].Hash < mUniforms[b].Hash; });
+    std::vector<UniformSlot> Sorted;
+    Sorted.reserve(mUniforms.size());
+    for (unsigned i = 0; i < Order.size(); ++i) {
+        if (i && mUniforms[Order[i]].Hash == mUniforms[Order[i - 1]].Hash) {
+            std::cerr << "[Err] Uniforms " << Names[Order[i - 1]] << " and " << Names[Order[i]] << " have the same hash" << std::endl;
+        }
+        Sorted.push_back(mUniforms[Order[i]]);
+    }
+    mUniforms = std::move(Sorted);
+}
+
+void
+Shader::bindUniformBlocks() const {
+    int Count = 0;
+    glGetProgramiv(mId, GL_ACTIVE_UNIFORM_BLOCKS, &Count);
+    for (int i = 0; i < Count; ++i) {
+        char Name[64];
+        glGetActiveUniformBlockName(mId, i, sizeof(Name), nullptr, Name);
+        const int Binding = UniformBuffer::FindBinding(Name);
+        if (Binding < 0) {
+            std::cerr << "[Err] Unknown uniform block " << Name << std::endl;
+            continue;
+        }
+        glUniformBlockBinding(mId, i, Binding);
+    }
+}
+
+Shader::UniformSlot*
+Shader::findUniform(const UniformName& uniform) const {
+    // Uniforms are usually set before the first Bind, the slots only exist once linked
+    ensureLinked();
+    auto It = std::lower_bound(mUniforms.begin(), mUniforms.end(), uniform.mHash,
+        [](const UniformSlot& slot, uint32_t hash) { return slot.Hash < hash; });
+    if (It == mUniforms.end() || It->Hash != uniform.mHash) {
+        return nullptr;
+    }
+    return &*It;
+}
+
+bool
+Shader::changeUniform(UniformSlot& slot, const void* value, size_t size) const {
+    if (slot.Valid && std::memcmp(slot.Value, value, size) == 0) {
+        ++sStats.Skipped;
+        return false;
+    }
+    std::memcpy(slot.Value, value, size);
+    slot.Valid = true;
+    ++sStats.Uploads;
+    Bind();
+    return true;
+}
+
+static void
+expandIncludes(const std::string& filename, std::string& source, std::vector<std::string>& included) {
     std::ifstream In(filename);
+    if (!In.is_open()) {
+        std::cerr << "[Err] Unable to open shader file: " << filename << std::endl;
+        return;
+    }
+
+    const std::string Directory = filename.substr(0, filename.find_last_of('/') + 1);
+    std::string Line;
+    while (std::getline(In, Line)) {
+        const size_t Start = Line.find_first_not_of(" \t");
+        if (Start != std::string::npos && Line.compare(Start, 8, "#include") == 0) {
+            const size_t Open = Line.find('"', Start);
+            const size_t Close = Open == std::string::npos ? Open : Line.find('"', Open + 1);
+            if (Close != std::string::npos) {
+                // Every file is included once, like with #pragma once
+                const std::string Path = Directory + Line.substr(Open + 1, Close - Open - 1);
+                if (std::find(included.begin(), included.end(), Path) == included.end()) {
+                    included.push_back(Path);
+                    expandIncludes(Path, source, included);
+                }
+                continue;
+            }
+        }
+        source += Line;
+        source += '\n';
+    }
+}
+
+std::string
+Shader::readSource(const std::string& filename, const std::vector<std::string>& defines) const {
     std::string Str;
+    std::vector<std::string> Included(1, filename);
+    expandIncludes(filename, Str, Included);
 
-    In.seekg(0, std::ios::end);
-    Str.reserve(In.tellg());
-    In.seekg(0, std::ios::beg);
+    std::string Defines;
+    for (const std::string& Define : defines) {
+        Defines += "#define " + Define + "\n";
+    }
+    const size_t Version = Str.find("#version");
+    const size_t LineEnd = Version == std::string::npos ? Version : Str.find('\n', Version);
+    Str.insert(LineEnd == std::string::npos ? 0 : LineEnd + 1, Defines);
+    return Str;
+}
 
-    Str.assign((std::istreambuf_iterator<char>(In)), std::istreambuf_iterator<char>());
-    const char* CharContent = Str.c_str();
+unsigned
+Shader::CreateComputeProgram(const std::string& cShaderPath) {
+    std::string Source;
+    std::vector<std::string> Included(1, cShaderPath);
+    expandIncludes(cShaderPath, Source, Included);
+    const char* CharContent = Source.c_str();
+    unsigned ComputeShader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(ComputeShader, 1, &CharContent, NULL);
+    glCompileShader(ComputeShader);
+
+    int Success;
+    char InfoLog[512];
+    glGetShaderiv(ComputeShader, GL_COMPILE_STATUS, &Success);
+    if (!Success) {
+        glGetShaderInfoLog(ComputeShader, 512, NULL, InfoLog);
+        std::cout << "Error while compiling shader [compute]:" << std::endl << InfoLog << std::endl;
+        glDeleteShader(ComputeShader);
+        return 0;
+    }
+    unsigned ProgramID = glCreateProgram();
+    glAttachShader(ProgramID, ComputeShader);
+    glLinkProgram(ProgramID);
+    glDetachShader(ProgramID, ComputeShader);
+    glDeleteShader(ComputeShader);
+    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Success);
+    if (!Success) {
+        glGetProgramInfoLog(ProgramID, 512, NULL, InfoLog);
+        std::cerr << "[Err] Failed to link shader program:" << std::endl << InfoLog << std::endl;
+        glDeleteProgram(ProgramID);
+        return 0;
+    }
+    std::cout << "Loaded " << cShaderPath << " shader" << std::endl;
+    return ProgramID;
+}
 
-    ShaderID = glCreateShader(shaderType);
+unsigned
+Shader::compileShader(const std::string& source, GLuint shaderType) const {
+    const char* CharContent = source.c_str();
+    unsigned ShaderID = glCreateShader(shaderType);
     glShaderSource(ShaderID, 1, &CharContent, NULL);
     glCompileShader(ShaderID);
+    return ShaderID;
+}
 
+bool
+Shader::checkShader(unsigned shader, GLuint shaderType, const std::string& filename) const {
     int Success;
     char InfoLog[512];
-    glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Success);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &Success);
     if (!Success) {
-        glGetShaderInfoLog(ShaderID, 256, NULL, InfoLog);
-        std::string ShaderTypeName = shaderType == GL_VERTEX_SHADER ? "vertex" : "fragment";
+        glGetShaderInfoLog(shader, 256, NULL, InfoLog);
+        std::string ShaderTypeName = shaderType == GL_VERTEX_SHADER ? "vertex" : shaderType == GL_GEOMETRY_SHADER ? "geometry" : "fragment";
         std::cout << "Error while compiling shader [" << ShaderTypeName << "]:" << std::endl << InfoLog << std::endl;
-        return 0;
+        return false;
     }
 
     std::cout << "Loaded " << filename << " shader" << std::endl;
 
-    return ShaderID;
+    return true;
 }
 
 unsigned
-Shader::createBasicProgram(unsigned vShader, unsigned fShader) {
+Shader::createBasicProgram(unsigned vShader, unsigned gShader, unsigned fShader) const {
     unsigned ProgramID = 0;
     ProgramID = glCreateProgram();
     glAttachShader(ProgramID, vShader);
+    if (gShader) {
+        glAttachShader(ProgramID, gShader);
+    }
     glAttachShader(ProgramID, fShader);
+    if (programBinariesSupported()) {
+        glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(ProgramID);
 
     int Success;
@@ -98,6 +547,36 @@ Shader::createBasicProgram(unsigned vShader, unsigned fShader) {
     glDetachShader(ProgramID, fShader);
     glDeleteShader(vShader);
     glDeleteShader(fShader);
+    if (gShader) {
+        glDetachShader(ProgramID, gShader);
+        glDeleteShader(gShader);
+    }
 
     return ProgramID;
-}
\ No newline at end of file
+}
+
+ShaderPermutations::ShaderPermutations(const std::string& vShaderPath, const std::string& fShaderPath, const std::vector<std::string>& keywords) {
+    mVertexPath = vShaderPath;
+    mFragmentPath = fShaderPath;
+    mKeywords = keywords;
+}
+
+Shader&
+ShaderPermutations::Get(unsigned features) {
+    std::unique_ptr<Shader>& Variant = mVariants[features];
+    if (!Variant) {
+        std::vector<std::string> Defines;
+        for (unsigned Keyword = 0; Keyword < mKeywords.size(); ++Keyword) {
+            if (features & (1u << Keyword)) {
+                Defines.push_back(mKeywords[Keyword]);
+            }
+        }
+        Variant = std::make_unique<Shader>(mVertexPath, mFragmentPath, Defines);
+    }
+    return *Variant;
+}
+
+unsigned
+ShaderPermutations::GetVariantCount() const {
+    return static_cast<unsigned>(mVariants.size());
+}
@@ -3,26 +3,131 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
+// Uniform handle hashed from its name. Declared constexpr the hash is computed
+// at compile time, so setting a uniform neither builds a string nor queries GL.
+class UniformName {
+
+private:
+    static constexpr uint32_t hash(const char* name, uint32_t hash = 0x811C9DC5u) {
+        return *name ? UniformName::hash(name + 1, (hash ^ static_cast<unsigned char>(*name)) * 0x01000193u) : hash;
+    }
+
+public:
+    uint32_t mHash;
+    const char* mName;
+    constexpr UniformName(const char* name) : mHash(hash(name)), mName(name) {}
+};
+
+struct UniformStats {
+    unsigned Uploads;
+    unsigned Skipped;
+};
+
+#define SHADER_CACHE_DIRECTORY "shader_cache"
+
+// How the programs created so far were obtained. Saved time is the compile
+// and link time recorded when the cached binaries were built.
+struct ShaderStartupReport {
+    unsigned Cached;
+    unsigned Compiled;
+    // Failed to compile or link, counted once their first use checks them
+    unsigned Failed;
+    unsigned Pending;
+    double LoadMs;
+    double CompileMs;
+    double SavedMs;
+};
+
 class Shader {
 
 private:
-    unsigned loadAndCompileShader(std::string filename, GLuint shaderType);
-    unsigned createBasicProgram(unsigned vShader, unsigned fShader);
-    unsigned mId;
+    // Location and last uploaded value of an active uniform, sorted by hash
+    struct UniformSlot {
+        uint32_t Hash;
+        int Location;
+        GLenum Type;
+        bool Valid;
+        float Value[16];
+    };
+
+    std::string readSource(const std::string& filename, const std::vector<std::string>& defines) const;
+    unsigned compileShader(const std::string& source, GLuint shaderType) const;
+    bool checkShader(unsigned shader, GLuint shaderType, const std::string& filename) const;
+    unsigned createBasicProgram(unsigned vShader, unsigned gShader, unsigned fShader) const;
+    bool loadBinary();
+    void saveBinary(double compileMs) const;
+    void ensureLinked() const;
+    void introspectUniforms() const;
+    void bindUniformBlocks() const;
+    UniformSlot* findUniform(const UniformName& uniform) const;
+    bool changeUniform(UniformSlot& slot, const void* value, size_t size) const;
+    // Programs that missed the binary cache are linked on first use
+    mutable unsigned mId;
+    mutable unsigned mVertexShader;
+    mutable unsigned mGeometryShader;
+    mutable unsigned mFragmentShader;
+    mutable bool mLinked;
+    std::string mVertexPath;
+    std::string mGeometryPath;
+    std::string mFragmentPath;
+    uint64_t mCacheKey;
+    double mIssueMs;
+    mutable std::vector<UniformSlot> mUniforms;
+    static unsigned sBoundProgram;
+    static UniformStats sStats;
+    static ShaderStartupReport sReport;
     static const unsigned POSITION_LOCATION = 0;
     static const unsigned COLOR_LOCATION = 1;
 
 public:
-    Shader(const std::string& vShaderPath, const std::string& fShaderPath);
+    // Sources may #include files relative to themselves, defines are inserted
+    // right after the #version line
+    Shader(const std::string& vShaderPath, const std::string& fShaderPath, const std::vector<std::string>& defines = {});
+    // With a geometry stage between the two, skipped when gShaderPath is empty
+    Shader(const std::string& vShaderPath, const std::string& gShaderPath, const std::string& fShaderPath, const std::vector<std::string>& defines = {});
     unsigned GetId() const;
-    void SetUniform1i(const std::string& uniform, int v) const;
-    void SetUniform1f(const std::string& uniform, float v) const;
-    void SetUniform3f(const std::string& uniform, const glm::vec3& v) const;
-    void SetUniform4m(const std::string& uniform, const glm::mat4& m) const;
+    void Bind() const;
+    static void Unbind();
+    // Compiles and links a compute shader, 0 when that fails. Compute programs
+    // are owned by their user and never cached.
+    static unsigned CreateComputeProgram(const std::string& cShaderPath);
+    // Compute work can run between a draw's Bind and the draw itself, it binds
+    // its program with UseProgram and puts the previous one back after
+    static unsigned GetBoundProgram();
+    static void UseProgram(unsigned program);
+    void SetUniform1i(const UniformName& uniform, int v) const;
+    void SetUniform1f(const UniformName& uniform, float v) const;
+    void SetUniform2f(const UniformName& uniform, const glm::vec2& v) const;
+    void SetUniform3f(const UniformName& uniform, const glm::vec3& v) const;
+    void SetUniform4m(const UniformName& uniform, const glm::mat4& m) const;
     void SetModel(const glm::mat4& m) const;
     void SetView(const glm::mat4& m) const;
     void SetProjection(const glm::mat4& m) const;
-};
\ No newline at end of file
+    // Uniform uploads made and skipped as unchanged since the last reset
+    static UniformStats GetUniformStats();
+    static void ResetUniformStats();
+    static ShaderStartupReport GetStartupReport();
+};
+
+// Permutations of one shader pair, one per combination of feature bits. Bit i
+// of a key defines the i-th keyword. Variants are created on first request
+// and kept, so switching back and forth between them costs nothing.
+class ShaderPermutations {
+
+private:
+    std::string mVertexPath;
+    std::string mFragmentPath;
+    std::vector<std::string> mKeywords;
+    std::unordered_map<unsigned, std::unique_ptr<Shader>> mVariants;
+
+public:
+    ShaderPermutations(const std::string& vShaderPath, const std::string& fShaderPath, const std::vector<std::string>& keywords);
+    Shader& Get(unsigned features);
+    unsigned GetVariantCount() const;
+};
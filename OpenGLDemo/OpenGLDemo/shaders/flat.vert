@@ -3,40 +3,18 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 
-uniform mat4 uProjection;
-uniform mat4 uView;
-uniform mat4 uModel;
+#include "frame.glsl"
+#include "lights.glsl"
 
-out vec3 FragColor;
-
-struct DirectionalLight {
-    vec3 Position;
-    vec3 Direction;
-    vec3 Ka;
-    vec3 Kd;
-    vec3 Ks;
-};
-
-struct Material {
-    vec3 Ka;
-    vec3 Kd;
-    vec3 Ks;
-    float Shininess;
-};
+#include "model_matrix.glsl"
 
-uniform DirectionalLight uDirLight;
-uniform Material uMaterial;
+out vec3 FragColor;
 
 void main() {
-    vec3 WorldSpaceVertex = vec3(uModel * vec4(aPos, 1.0f));
-    vec3 WorldSpaceNormal = normalize(mat3(transpose(inverse(uModel))) * aNormal);
-
-    vec3 DirLightVector = normalize(-uDirLight.Direction);
-    float DirDiffuse = max(dot(WorldSpaceNormal, DirLightVector), 0.0f);
-    vec3 DirAmbientColor = uDirLight.Ka * uMaterial.Ka;
-    vec3 DirDiffuseColor = DirDiffuse * uDirLight.Kd * uMaterial.Kd;
+    vec3 WorldSpaceNormal = normalize(mat3(transpose(inverse(MODEL_MATRIX))) * aNormal);
 
-    FragColor = DirAmbientColor + DirDiffuseColor;
+    // Flat shading only takes the ambient and diffuse part of the directional light
+    FragColor = DirLightColor(WorldSpaceNormal, vec3(0.0f), uMaterial.Ka, uMaterial.Kd, vec3(0.0f));
 
-    gl_Position = uProjection * uView * uModel * vec4(aPos, 1.0f);
+    gl_Position = uProjection * uView * MODEL_MATRIX * vec4(aPos, 1.0f);
 }
@@ -0,0 +1,5 @@
+layout (std140) uniform FrameData {
+    mat4 uProjection;
+    mat4 uView;
+    vec3 uViewPos;
+};
@@ -0,0 +1,92 @@
+// Lighting shared by the lit shaders. The flashlight is only evaluated in
+// variants built with FLASHLIGHT defined.
+
+struct PositionalLight {
+    vec3 Position;
+    vec3 Ka;
+    vec3 Kd;
+    vec3 Ks;
+    float Kc;
+    float Kl;
+    float Kq;
+};
+
+struct DirectionalLight {
+    vec3 Position;
+    vec3 Direction;
+    vec3 Ka;
+    vec3 Kd;
+    vec3 Ks;
+    float InnerCutOff;
+    float OuterCutOff;
+    float Kc;
+    float Kl;
+    float Kq;
+};
+
+struct Material {
+    vec3 Ka;
+    vec3 Kd;
+    vec3 Ks;
+    float Shininess;
+};
+
+layout (std140) uniform LightData {
+    PositionalLight uSunLight;
+    DirectionalLight uFlashLight;
+    DirectionalLight uDirLight;
+};
+
+layout (std140) uniform MaterialData {
+    Material uMaterial;
+};
+
+vec3 DirLightColor(vec3 normal, vec3 viewDirection, vec3 ka, vec3 kd, vec3 ks) {
+    vec3 DirLightVector = normalize(-uDirLight.Direction);
+    float DirDiffuse = max(dot(normal, DirLightVector), 0.0f);
+    vec3 DirReflectDirection = reflect(-DirLightVector, normal);
+    float DirSpecular = pow(max(dot(viewDirection, DirReflectDirection), 0.0f), uMaterial.Shininess);
+    vec3 DirAmbientColor = uDirLight.Ka * ka;
+    vec3 DirDiffuseColor = uDirLight.Kd * DirDiffuse * kd;
+    vec3 DirSpecularColor = uDirLight.Ks * DirSpecular * ks;
+    return DirAmbientColor + DirDiffuseColor + DirSpecularColor;
+}
+
+vec3 SunLightColor(vec3 position, vec3 normal, vec3 viewDirection, vec3 ka, vec3 kd, vec3 ks) {
+    vec3 PtLightVector = normalize(uSunLight.Position - position);
+    float PtDiffuse = max(dot(normal, PtLightVector), 0.0f);
+    vec3 PtReflectDirection = reflect(-PtLightVector, normal);
+    float PtSpecular = pow(max(dot(viewDirection, PtReflectDirection), 0.0f), uMaterial.Shininess);
+    vec3 PtAmbientColor = uSunLight.Ka * ka;
+    vec3 PtDiffuseColor = PtDiffuse * uSunLight.Kd * kd;
+    vec3 PtSpecularColor = PtSpecular * uSunLight.Ks * ks;
+    float PtLightDistance = length(uSunLight.Position - position);
+    float PtAttenuation = 1.0f / (uSunLight.Kc + uSunLight.Kl * PtLightDistance + uSunLight.Kq * (PtLightDistance * PtLightDistance));
+    return PtAttenuation * (PtAmbientColor + PtDiffuseColor + PtSpecularColor);
+}
+
+#ifdef FLASHLIGHT
+vec3 FlashLightColor(vec3 position, vec3 normal, vec3 viewDirection, vec3 ka, vec3 kd, vec3 ks) {
+    vec3 SpotlightVector = normalize(uFlashLight.Position - position);
+    float SpotDiffuse = max(dot(normal, SpotlightVector), 0.0f);
+    vec3 SpotReflectDirection = reflect(-SpotlightVector, normal);
+    float SpotSpecular = pow(max(dot(viewDirection, SpotReflectDirection), 0.0f), uMaterial.Shininess);
+    vec3 SpotAmbientColor = uFlashLight.Ka * ka;
+    vec3 SpotDiffuseColor = SpotDiffuse * uFlashLight.Kd * kd;
+    vec3 SpotSpecularColor = SpotSpecular * uFlashLight.Ks * ks;
+    float SpotlightDistance = length(uFlashLight.Position - position);
+    float SpotAttenuation = 1.0f / (uFlashLight.Kc + uFlashLight.Kl * SpotlightDistance + uFlashLight.Kq * (SpotlightDistance * SpotlightDistance));
+    float Theta = dot(SpotlightVector, normalize(-uFlashLight.Direction));
+    float Epsilon = uFlashLight.InnerCutOff - uFlashLight.OuterCutOff;
+    float SpotIntensity = clamp((Theta - uFlashLight.OuterCutOff) / Epsilon, 0.0f, 1.0f);
+    return SpotIntensity * SpotAttenuation * (SpotAmbientColor + SpotDiffuseColor + SpotSpecularColor);
+}
+#endif
+
+vec3 LightColor(vec3 position, vec3 normal, vec3 viewDirection, vec3 ka, vec3 kd, vec3 ks) {
+    vec3 Color = DirLightColor(normal, viewDirection, ka, kd, ks) + SunLightColor(position, normal, viewDirection, ka, kd, ks);
+#ifdef FLASHLIGHT
+    Color += FlashLightColor(position, normal, viewDirection, ka, kd, ks);
+#endif
+    return Color;
+}
@@ -0,0 +1,10 @@
+#ifdef USE_INSTANCING
+// Transform of each instance, a mat4 takes locations 3 to 6
+layout (location = 3) in mat4 aInstanceModel;
+// Placement inside the instance, the same for a whole draw
+layout (location = 7) in mat4 aInstanceLocal;
+#define MODEL_MATRIX (aInstanceModel * aInstanceLocal)
+#else
+uniform mat4 uModel;
+#define MODEL_MATRIX uModel
+#endif
@@ -0,0 +1,15 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+#include "model_matrix.glsl"
+
+out vec3 vNormal;
+out mat4 vModel;
+
+// Positions stay in model space, the geometry shader transforms both ends
+void main() {
+    vNormal = aNormal;
+    vModel = MODEL_MATRIX;
+    gl_Position = vec4(aPos, 1.0f);
+}
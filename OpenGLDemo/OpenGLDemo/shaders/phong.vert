@@ -2,15 +2,21 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aUV;
-uniform mat4 uProjection;
-uniform mat4 uView;
-uniform mat4 uModel;
+#include "frame.glsl"
+#include "model_matrix.glsl"
 out vec2 UV;
 out vec3 vWorldSpaceFragment;
 out vec3 vWorldSpaceNormal;
+#ifdef USE_INSTANCING
+// Negative for mirrored instances, whose triangles wind the other way
+out float vFrontWinding;
+#endif
 void main() {
-	vWorldSpaceFragment = vec3(uModel * vec4(aPos, 1.0f));
-	vWorldSpaceNormal = normalize(mat3(transpose(inverse(uModel))) * aNormal);
+#ifdef USE_INSTANCING
+	vFrontWinding = sign(determinant(mat3(MODEL_MATRIX)));
+#endif
+	vWorldSpaceFragment = vec3(MODEL_MATRIX * vec4(aPos, 1.0f));
+	vWorldSpaceNormal = normalize(mat3(transpose(inverse(MODEL_MATRIX))) * aNormal);
 	UV = aUV;
-	gl_Position = uProjection * uView * uModel * vec4(aPos, 1.0f);
+	gl_Position = uProjection * uView * MODEL_MATRIX * vec4(aPos, 1.0f);
 }
\ No newline at end of file
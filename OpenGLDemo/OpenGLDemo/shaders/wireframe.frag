@@ -0,0 +1,16 @@
+#version 330 core
+
+uniform vec3 uColor;
+uniform vec3 uWireColor;
+uniform float uWireWidth;
+
+noperspective in vec3 gEdgeDistance;
+
+out vec4 FragColor;
+
+void main() {
+    float Distance = min(gEdgeDistance.x, min(gEdgeDistance.y, gEdgeDistance.z));
+    // One pixel of smoothing on the outside of the line
+    float Wire = 1.0f - smoothstep(uWireWidth * 0.5f - 0.5f, uWireWidth * 0.5f + 0.5f, Distance);
+    FragColor = vec4(mix(uColor, uWireColor, Wire), 1.0f);
+}
@@ -0,0 +1,96 @@
+#include "smooth_normals.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include "shader.hpp"
+
+#define SMOOTH_NORMALS_LOCAL_SIZE 64
+#define SMOOTH_NORMALS_MAX_WORK_GROUPS 65535
+
+unsigned SmoothNormals::sProgram = 0;
+bool SmoothNormals::sCreated = false;
+bool SmoothNormals::sEnabled = true;
+SmoothNormalsStats SmoothNormals::sStats = { 0, 0, 0.0 };
+
+bool
+SmoothNormals::createProgram() {
+    sCreated = true;
+    sProgram = Shader::CreateComputeProgram(SMOOTH_NORMALS_SHADER_PATH);
+    return sProgram != 0;
+}
+
+bool
+SmoothNormals::IsAvailable() {
+    // The context asks for 3.3, drivers usually give the newest core version anyway
+    return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object);
+}
+
+bool
+SmoothNormals::IsEnabled() {
+    return sEnabled;
+}
+
+void
+SmoothNormals::SetEnabled(bool enabled) {
+    sEnabled = enabled;
+}
+
+bool
+SmoothNormals::Build(const ArenaAllocation& flatVertices, const ArenaAllocation& smoothVertices,
+    const std::vector<unsigned>& groups, unsigned groupCount) {
+    if (!sEnabled || !IsAvailable() || !groupCount || groups.size() != groupCount + 1 + flatVertices.Count) {
+        return false;
+    }
+    if (!sCreated && !createProgram()) {
+        std::cerr << "Smooth normals are built on the CPU instead" << std::endl;
+    }
+    if (!sProgram) {
+        return false;
+    }
+    const auto Start = std::chrono::steady_clock::now();
+
+    unsigned GroupBuffer;
+    glGenBuffers(1, &GroupBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, GroupBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, groups.size() * sizeof(unsigned), groups.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, GeometryArena::GetVertexBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, GroupBuffer);
+
+    // Runs lazily from inside draw passes, whose program has to stay bound
+    const unsigned PreviousProgram = Shader::GetBoundProgram();
+    Shader::UseProgram(sProgram);
+    glUniform1ui(glGetUniformLocation(sProgram, "uGroupCount"), groupCount);
+    glUniform1ui(glGetUniformLocation(sProgram, "uMembersOffset"), groupCount + 1);
+    glUniform1ui(glGetUniformLocation(sProgram, "uFlatFirst"), flatVertices.Offset);
+    glUniform1ui(glGetUniformLocation(sProgram, "uSmoothFirst"), smoothVertices.Offset);
+    const GLint GroupBase = glGetUniformLocation(sProgram, "uGroupBase");
+    // Dispatches are limited in size, very large meshes take several
+    const unsigned GroupsPerDispatch = SMOOTH_NORMALS_LOCAL_SIZE * SMOOTH_NORMALS_MAX_WORK_GROUPS;
+    for (unsigned Base = 0; Base < groupCount; Base += GroupsPerDispatch) {
+        const unsigned Count = std::min(groupCount - Base, GroupsPerDispatch);
+        glUniform1ui(GroupBase, Base);
+        glDispatchCompute((Count + SMOOTH_NORMALS_LOCAL_SIZE - 1) / SMOOTH_NORMALS_LOCAL_SIZE, 1, 1);
+    }
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    Shader::UseProgram(PreviousProgram);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    glDeleteBuffers(1, &GroupBuffer);
+
+    ++sStats.GpuMeshes;
+    sStats.GpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+    return true;
+}
+
+void
+SmoothNormals::CountCpuMesh() {
+    ++sStats.CpuMeshes;
+}
+
+SmoothNormalsStats
+SmoothNormals::GetStats() {
+    return sStats;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+#include "geometry_arena.hpp"
+
+#define SMOOTH_NORMALS_SHADER_PATH "shaders/smooth_normals.comp"
+// Smaller meshes are done faster on a worker than the dispatch costs to set up
+#define SMOOTH_NORMALS_GPU_MIN_VERTICES 65536
+
+struct SmoothNormalsStats {
+    unsigned GpuMeshes;
+    unsigned CpuMeshes;
+    double GpuMs;
+};
+
+// Builds smooth vertices with a compute shader straight into the geometry
+// arena. Vertices are grouped by welded position beforehand, with members in
+// vertex order like VertexWeld sums them, and one invocation averages the
+// distinct normals of a group and writes every member. Needs GL 4.3, the CPU
+// path in Mesh is used otherwise. Only used from the GL thread.
+class SmoothNormals {
+
+private:
+    static unsigned sProgram;
+    static bool sCreated;
+    static bool sEnabled;
+    static SmoothNormalsStats sStats;
+
+    static bool createProgram();
+
+public:
+    static bool IsAvailable();
+    static bool IsEnabled();
+    static void SetEnabled(bool enabled);
+    // Groups holds the start of every group plus one past the last, followed
+    // by the members of all groups
+    static bool Build(const ArenaAllocation& flatVertices, const ArenaAllocation& smoothVertices,
+        const std::vector<unsigned>& groups, unsigned groupCount);
+    static void CountCpuMesh();
+    static SmoothNormalsStats GetStats();
+};
@@ -2,39 +2,347 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include "thread_pool.hpp"
+
+std::unordered_map<std::string, TextureCache::Entry> TextureCache::sEntries;
+std::unordered_map<unsigned, std::string> TextureCache::sKeys;
+std::unordered_set<std::string> TextureCache::sFailed;
+std::deque<TextureCache::PendingUpload> TextureCache::sPending;
+unsigned TextureCache::sPixelBuffer = 0;
+double TextureCache::sUploadBudgetMs = DEFAULT_TEXTURE_UPLOAD_BUDGET_MS;
+TextureCacheStats TextureCache::sStats = { 0, 0, 0, 0, 0.0, 0.0, 0, 0 };
+
 unsigned
 Texture::LoadImageToTexture(const std::string& filePath) {
-    int TextureWidth;
-    int TextureHeight;
-    int TextureChannels;
-    std::cout << "Loading texture: " << filePath << std::endl;
-    unsigned char* ImageData = stbi_load(filePath.c_str(), &TextureWidth, &TextureHeight, &TextureChannels, 0);
-
-    if (!ImageData) {
+    unsigned Texture = TryLoadImageToTexture(filePath);
+    if (!Texture) {
         std::cerr << "Failed to load texture: " << filePath << " loading default instead" << std::endl;
         return LoadImageToTexture(MISSING_TEXTURE_PATH);
     }
+    return Texture;
+}
+
+unsigned
+Texture::TryLoadImageToTexture(const std::string& filePath, const SamplerParams& sampler) {
+    std::cout << "Loading texture: " << filePath << std::endl;
+    DecodedImage Image = DecodeImage(filePath);
+    if (!Image.Pixels) {
+        return 0;
+    }
+
+    unsigned Texture;
+    glGenTextures(1, &Texture);
+    UploadImage(Texture, Image, Image.Pixels.get(), sampler);
+    return Texture;
+}
+
+DecodedImage
+Texture::DecodeImage(const std::string& filePath) {
+    DecodedImage Image;
+    // Flipping while decoding saves a separate pass over the pixels
+    stbi_set_flip_vertically_on_load_thread(1);
+    unsigned char* ImageData = stbi_load(filePath.c_str(), &Image.Width, &Image.Height, &Image.Channels, 0);
+    Image.Pixels = std::unique_ptr<unsigned char, void (*)(void*)>(ImageData, stbi_image_free);
+    return Image;
+}
 
-    stbi__vertical_flip(ImageData, TextureWidth, TextureHeight, TextureChannels);
+LoadedImage
+Texture::LoadImageData(const std::string& filePath, bool compress) {
+    const auto StartTime = std::chrono::steady_clock::now();
+    LoadedImage Image;
+    const std::string CachePath = compress ? TextureCooker::CachePath(filePath) : std::string();
+    if (CachePath.empty() || !TextureCooker::ReadKtx2(CachePath, Image.Compressed)) {
+        Image.Compressed = CompressedImage();
+        Image.Log += "Loading texture: " + filePath + "\n";
+        Image.Decoded = DecodeImage(filePath);
+        const DecodedImage& Decoded = Image.Decoded;
+        if (!CachePath.empty() && Decoded.Pixels
+            && TextureCooker::Cook(Decoded.Pixels.get(), Decoded.Width, Decoded.Height, Decoded.Channels, Image.Compressed)) {
+            TextureCooker::WriteKtx2(CachePath, Image.Compressed);
+            Image.Decoded = DecodedImage();
+        }
+    }
+    Image.LoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+    return Image;
+}
 
+void
+Texture::UploadCompressed(unsigned texture, const CompressedImage& image, bool fromPixelBuffer, const SamplerParams& sampler) {
+    const GLsizei LevelCount = static_cast<GLsizei>(image.Levels.size());
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, LevelCount, image.Format, image.Levels[0].Width, image.Levels[0].Height);
+    }
+    size_t Offset = 0;
+    for (GLsizei Level = 0; Level < LevelCount; ++Level) {
+        const CompressedLevel& Source = image.Levels[Level];
+        const GLsizei Size = static_cast<GLsizei>(Source.Data.size());
+        const void* Data = fromPixelBuffer ? reinterpret_cast<const void*>(Offset) : Source.Data.data();
+        if (GLEW_ARB_texture_storage) {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, Level, 0, 0, Source.Width, Source.Height, image.Format, Size, Data);
+        }
+        else {
+            glCompressedTexImage2D(GL_TEXTURE_2D, Level, image.Format, Source.Width, Source.Height, 0, Size, Data);
+        }
+        Offset += Source.Data.size();
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, LevelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.WrapS);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.WrapT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.MinFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.MagFilter);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void
+Texture::UploadImage(unsigned texture, const DecodedImage& image, const void* pixels, const SamplerParams& sampler) {
     GLint InternalFormat = -1;
-    switch (TextureChannels) {
+    switch (image.Channels) {
     case 1: InternalFormat = GL_RED; break;
     case 3: InternalFormat = GL_RGB; break;
     case 4: InternalFormat = GL_RGBA; break;
     default: InternalFormat = GL_RGB; break;
     }
 
-    unsigned Texture;
-    glGenTextures(1, &Texture);
-    glBindTexture(GL_TEXTURE_2D, Texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, InternalFormat, TextureWidth, TextureHeight, 0, InternalFormat, GL_UNSIGNED_BYTE, ImageData);
+    // stb_image rows are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, InternalFormat, image.Width, image.Height, 0, InternalFormat, GL_UNSIGNED_BYTE, pixels);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.WrapS);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.WrapT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.MinFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.MagFilter);
     glBindTexture(GL_TEXTURE_2D, 0);
-    stbi_image_free(ImageData);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+std::string
+TextureCache::CanonicalPath(const std::string& filePath) {
+    std::error_code Error;
+    std::string Path = std::filesystem::weakly_canonical(filePath, Error).generic_string();
+    if (Error || Path.empty()) {
+        Path = filePath;
+    }
+    return Path;
+}
+
+void
+TextureCache::CountLookup(bool hit) {
+    if (hit) {
+        sStats.Hits++;
+    }
+    else {
+        sStats.Misses++;
+    }
+}
+
+std::string
+TextureCache::key(const std::string& filePath, const SamplerParams& sampler) {
+    return CanonicalPath(filePath) + "|" + std::to_string(sampler.WrapS) + "|" + std::to_string(sampler.WrapT)
+        + "|" + std::to_string(sampler.MinFilter) + "|" + std::to_string(sampler.MagFilter);
+}
+
+unsigned
+TextureCache::Acquire(const std::string& filePath, const SamplerParams& sampler) {
+    const std::string Key = key(filePath, sampler);
+    auto It = sEntries.find(Key);
+    if (It != sEntries.end()) {
+        sStats.Hits++;
+        It->second.References++;
+        return It->second.Texture;
+    }
+
+    // Images that failed once share the missing texture without being decoded
+    // again, or a built-in one when the missing texture failed as well
+    if (sFailed.count(Key)) {
+        sStats.Hits++;
+        const std::string MissingKey = key(MISSING_TEXTURE_PATH, sampler);
+        if (Key != MissingKey && !sFailed.count(MissingKey)) {
+            return Acquire(MISSING_TEXTURE_PATH, sampler);
+        }
+        return acquireBuiltin(sampler);
+    }
+
+    sStats.Misses++;
+    static const unsigned char GREY[4] = { 128, 128, 128, 255 };
+    const unsigned Placeholder = createSolid(GREY, sampler);
+    sPending.push_back({ Placeholder, filePath, sampler, submitLoad(filePath) });
+    sEntries[Key] = { Placeholder, 1, 4, false };
+    sStats.VideoMemoryBytes += 4;
+    sKeys[Placeholder] = Key;
+    sStats.Textures = static_cast<unsigned>(sEntries.size());
+    sStats.Pending = static_cast<unsigned>(sPending.size());
+    return Placeholder;
+}
+
+void
+TextureCache::Release(unsigned texture) {
+    auto Key = sKeys.find(texture);
+    if (Key == sKeys.end()) {
+        return;
+    }
+    auto It = sEntries.find(Key->second);
+    if (--It->second.References == 0) {
+        // A decode that is still running is left to finish on its own
+        for (auto Pending = sPending.begin(); Pending != sPending.end(); ++Pending) {
+            if (Pending->Texture == texture) {
+                sPending.erase(Pending);
+                break;
+            }
+        }
+        sStats.Pending = static_cast<unsigned>(sPending.size());
+        sStats.VideoMemoryBytes -= It->second.Bytes;
+        sStats.Compressed -= It->second.Compressed ? 1 : 0;
+        glDeleteTextures(1, &texture);
+        sEntries.erase(It);
+        sKeys.erase(Key);
+        sStats.Textures = static_cast<unsigned>(sEntries.size());
+    }
+}
+
+unsigned
+TextureCache::acquireBuiltin(const SamplerParams& sampler) {
+    static const unsigned char MAGENTA[4] = { 255, 0, 255, 255 };
+    const std::string Key = key(BUILTIN_TEXTURE_PATH, sampler);
+    auto It = sEntries.find(Key);
+    if (It != sEntries.end()) {
+        It->second.References++;
+        return It->second.Texture;
+    }
+    const unsigned Texture = createSolid(MAGENTA, sampler);
+    sEntries[Key] = { Texture, 1, 4, false };
+    sStats.VideoMemoryBytes += 4;
+    sKeys[Texture] = Key;
+    sStats.Textures = static_cast<unsigned>(sEntries.size());
     return Texture;
-}
\ No newline at end of file
+}
+
+unsigned
+TextureCache::createSolid(const unsigned char* rgba, const SamplerParams& sampler) {
+    DecodedImage Image;
+    Image.Width = 1;
+    Image.Height = 1;
+    Image.Channels = 4;
+
+    unsigned Texture;
+    glGenTextures(1, &Texture);
+    Texture::UploadImage(Texture, Image, rgba, sampler);
+    return Texture;
+}
+
+std::future<LoadedImage>
+TextureCache::submitLoad(const std::string& filePath) {
+    // S3TC is an extension even though nearly every desktop driver, Mesa's
+    // software rasterizers included, exposes it. RGTC is core since GL 3.0.
+    static const bool Compression = GLEW_EXT_texture_compression_s3tc != 0;
+    return ThreadPool::Shared().Submit([filePath] { return Texture::LoadImageData(filePath, Compression); });
+}
+
+void
+TextureCache::streamImage(unsigned texture, const LoadedImage& image, const SamplerParams& sampler) {
+    const bool Compressed = !image.Compressed.Levels.empty();
+    const DecodedImage& Decoded = image.Decoded;
+    const size_t Size = Compressed ? TextureCooker::GetByteSize(image.Compressed)
+        : static_cast<size_t>(Decoded.Width) * Decoded.Height * Decoded.Channels;
+
+    // Orphaning the buffer lets the driver keep feeding the previous upload
+    // while this one is written
+    if (!sPixelBuffer) {
+        glGenBuffers(1, &sPixelBuffer);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, sPixelBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, Size, nullptr, GL_STREAM_DRAW);
+    unsigned char* Mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, Size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (Mapped) {
+        if (Compressed) {
+            for (const CompressedLevel& Level : image.Compressed.Levels) {
+                std::memcpy(Mapped, Level.Data.data(), Level.Data.size());
+                Mapped += Level.Data.size();
+            }
+        }
+        else {
+            std::memcpy(Mapped, Decoded.Pixels.get(), Size);
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    else {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    if (Compressed) {
+        Texture::UploadCompressed(texture, image.Compressed, Mapped != nullptr, sampler);
+    }
+    else {
+        Texture::UploadImage(texture, Decoded, Mapped ? nullptr : Decoded.Pixels.get(), sampler);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Uncompressed textures count as four bytes per texel (one for red only)
+    // plus a third for the generated mip chain
+    const size_t Bytes = Compressed ? Size : static_cast<size_t>(Decoded.Width) * Decoded.Height * (Decoded.Channels == 1 ? 1 : 4) * 4 / 3;
+    Entry& Target = sEntries[sKeys[texture]];
+    sStats.VideoMemoryBytes += Bytes - Target.Bytes;
+    Target.Bytes = Bytes;
+    sStats.Compressed += (Compressed ? 1 : 0) - (Target.Compressed ? 1 : 0);
+    Target.Compressed = Compressed;
+    sStats.LoadMs += image.LoadMs;
+}
+
+void
+TextureCache::Update() {
+    const auto StartTime = std::chrono::steady_clock::now();
+    double Elapsed = 0.0;
+    unsigned Uploaded = 0;
+    for (auto It = sPending.begin(); It != sPending.end();) {
+        // At least one upload per frame so a tiny budget still makes progress
+        if (Uploaded && Elapsed >= sUploadBudgetMs) {
+            break;
+        }
+        if (It->Image.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++It;
+            continue;
+        }
+
+        LoadedImage Image = It->Image.get();
+        std::cout << Image.Log;
+        if (!Image.Decoded.Pixels && Image.Compressed.Levels.empty()) {
+            sFailed.insert(sKeys[It->Texture]);
+            if (It->Path == MISSING_TEXTURE_PATH) {
+                sFailed.insert(key(MISSING_TEXTURE_PATH, It->Sampler));
+                std::cerr << "Failed to load texture: " << It->Path << std::endl;
+                It = sPending.erase(It);
+                continue;
+            }
+            std::cerr << "Failed to load texture: " << It->Path << " loading default instead" << std::endl;
+            It->Path = MISSING_TEXTURE_PATH;
+            It->Image = submitLoad(MISSING_TEXTURE_PATH);
+            ++It;
+            continue;
+        }
+
+        streamImage(It->Texture, Image, It->Sampler);
+        It = sPending.erase(It);
+        ++Uploaded;
+        Elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+    }
+    sStats.Pending = static_cast<unsigned>(sPending.size());
+    sStats.UploadMs = Elapsed;
+}
+
+void
+TextureCache::SetUploadBudget(double milliseconds) {
+    sUploadBudgetMs = milliseconds;
+}
+
+double
+TextureCache::GetUploadBudget() {
+    return sUploadBudgetMs;
+}
+
+TextureCacheStats
+TextureCache::GetStats() {
+    return sStats;
+}
@@ -1,12 +1,123 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <GL/glew.h>
 #include <iostream>
+#include "texture_cooker.hpp"
 
 static const std::string MISSING_TEXTURE_PATH = "res/missing_texture.png";
+// Cache key of the 1x1 texture used when even the missing texture fails to load
+static const std::string BUILTIN_TEXTURE_PATH = "<builtin>";
+#define DEFAULT_TEXTURE_UPLOAD_BUDGET_MS 2.0
+
+struct SamplerParams {
+	GLint WrapS = GL_REPEAT;
+	GLint WrapT = GL_REPEAT;
+	GLint MinFilter = GL_LINEAR_MIPMAP_LINEAR;
+	GLint MagFilter = GL_NEAREST;
+};
+
+// Pixels as returned by stb_image, bottom row first
+struct DecodedImage {
+	std::unique_ptr<unsigned char, void (*)(void*)> Pixels{ nullptr, nullptr };
+	int Width = 0;
+	int Height = 0;
+	int Channels = 0;
+};
+
+// Result of loading a texture off the GL thread, either block compressed from
+// the cooked cache or decoded pixels when compression is not available
+struct LoadedImage {
+	DecodedImage Decoded;
+	CompressedImage Compressed;
+	double LoadMs = 0.0;
+	// Messages of the load, printed by whoever collects it on the GL thread so
+	// lines of concurrent loads do not interleave
+	std::string Log;
+};
 
 class Texture {
 
 public:
 	static unsigned LoadImageToTexture(const std::string& filePath);
+	// Returns 0 instead of falling back to the missing texture
+	static unsigned TryLoadImageToTexture(const std::string& filePath, const SamplerParams& sampler = SamplerParams());
+	// Does not touch GL or print, safe to call from worker threads
+	static DecodedImage DecodeImage(const std::string& filePath);
+	// Reads the cooked KTX2 file, cooking and storing it first when it is
+	// missing or stale. Falls back to decoded pixels without compression.
+	static LoadedImage LoadImageData(const std::string& filePath, bool compress);
+	// Uploads from the bound pixel unpack buffer when pixels is an offset into it
+	static void UploadImage(unsigned texture, const DecodedImage& image, const void* pixels, const SamplerParams& sampler);
+	// Immutable storage with the cooked mip chain, levels come one after
+	// another from the bound pixel unpack buffer when fromPixelBuffer is set
+	static void UploadCompressed(unsigned texture, const CompressedImage& image, bool fromPixelBuffer, const SamplerParams& sampler);
+};
+
+struct TextureCacheStats {
+	unsigned Hits;
+	unsigned Misses;
+	unsigned Textures;
+	unsigned Pending;
+	double UploadMs;
+	double LoadMs;
+	size_t VideoMemoryBytes;
+	unsigned Compressed;
+};
+
+// Reference counted textures keyed by canonical path and sampler parameters.
+// Every image is decoded and uploaded once no matter how many meshes use it,
+// and deleted when the last user releases it. Only used from the GL thread.
+//
+// Acquire returns at once with a texture holding a grey placeholder. Images
+// are decoded on the shared thread pool and Update, called once per frame,
+// streams finished ones into their textures through a pixel buffer object
+// until the upload budget for the frame is spent.
+class TextureCache {
+
+private:
+	struct Entry {
+		unsigned Texture;
+		unsigned References;
+		size_t Bytes;
+		bool Compressed;
+	};
+	struct PendingUpload {
+		unsigned Texture;
+		std::string Path;
+		SamplerParams Sampler;
+		std::future<LoadedImage> Image;
+	};
+
+	static std::unordered_map<std::string, Entry> sEntries;
+	static std::unordered_map<unsigned, std::string> sKeys;
+	static std::unordered_set<std::string> sFailed;
+	static std::deque<PendingUpload> sPending;
+	static unsigned sPixelBuffer;
+	static double sUploadBudgetMs;
+	static TextureCacheStats sStats;
+
+	static std::string key(const std::string& filePath, const SamplerParams& sampler);
+	static unsigned createSolid(const unsigned char* rgba, const SamplerParams& sampler);
+	static unsigned acquireBuiltin(const SamplerParams& sampler);
+	static void streamImage(unsigned texture, const LoadedImage& image, const SamplerParams& sampler);
+	static std::future<LoadedImage> submitLoad(const std::string& filePath);
+
+public:
+	static unsigned Acquire(const std::string& filePath, const SamplerParams& sampler = SamplerParams());
+	static void Release(unsigned texture);
+	static void Update();
+	static void SetUploadBudget(double milliseconds);
+	static double GetUploadBudget();
+	static TextureCacheStats GetStats();
+	// The path part of the keys, for images kept outside the cache that should
+	// be told apart the same way
+	static std::string CanonicalPath(const std::string& filePath);
+	// Lookups of such images count towards the hits and misses
+	static void CountLookup(bool hit);
 };
@@ -0,0 +1,279 @@
+#include "texture_atlas.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include "thread_pool.hpp"
+
+unsigned TextureAtlas::sBinds = 0;
+
+// Decoded images of every channel count share the RGBA8 arrays
+static void
+expandToRgba(DecodedImage& image) {
+    if (!image.Pixels || image.Channels == 4) {
+        return;
+    }
+    const size_t TexelCount = static_cast<size_t>(image.Width) * image.Height;
+    unsigned char* Rgba = static_cast<unsigned char*>(std::malloc(TexelCount * 4));
+    if (!Rgba) {
+        image.Pixels.reset();
+        return;
+    }
+    const unsigned char* Source = image.Pixels.get();
+    for (size_t Texel = 0; Texel < TexelCount; ++Texel) {
+        const unsigned char* In = Source + Texel * image.Channels;
+        unsigned char* Out = Rgba + Texel * 4;
+        // Grey and grey with alpha as stb_image returns them
+        Out[0] = In[0];
+        Out[1] = image.Channels >= 3 ? In[1] : In[0];
+        Out[2] = image.Channels >= 3 ? In[2] : In[0];
+        Out[3] = image.Channels == 2 ? In[1] : 255;
+    }
+    image.Pixels = std::unique_ptr<unsigned char, void (*)(void*)>(Rgba, std::free);
+    image.Channels = 4;
+}
+
+static bool
+isLoaded(const LoadedImage& image) {
+    return image.Decoded.Pixels || !image.Compressed.Levels.empty();
+}
+
+TextureAtlas::~TextureAtlas() {
+    for (const Array& Target : mArrays) {
+        glDeleteTextures(1, &Target.Texture);
+    }
+    glDeleteTextures(1, &mPlaceholder);
+}
+
+// Empty paths stay empty, they stand for the missing texture
+static std::string
+slotKey(const std::string& filePath) {
+    return filePath.empty() ? filePath : TextureCache::CanonicalPath(filePath);
+}
+
+void
+TextureAtlas::Add(const std::string& filePath) {
+    const std::string Key = slotKey(filePath);
+    const bool Added = mSlots.emplace(Key, AtlasSlot()).second;
+    if (Added) {
+        mPaths.push_back(Key);
+    }
+    if (!filePath.empty()) {
+        TextureCache::CountLookup(!Added);
+    }
+}
+
+void
+TextureAtlas::Build() {
+    static const unsigned char GREY[4] = { 128, 128, 128, 255 };
+    glGenTextures(1, &mPlaceholder);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mPlaceholder);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, GREY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    const bool Compression = GLEW_EXT_texture_compression_s3tc != 0;
+    std::vector<std::string> Paths = mPaths;
+    Paths.push_back(MISSING_TEXTURE_PATH);
+    mJobs.reserve(Paths.size());
+    for (const std::string& Path : Paths) {
+        mJobs.push_back(ThreadPool::Shared().Submit([Path, Compression] {
+            LoadedImage Image;
+            if (!Path.empty()) {
+                Image = Texture::LoadImageData(Path, Compression);
+                expandToRgba(Image.Decoded);
+            }
+            return Image;
+        }));
+    }
+}
+
+bool
+TextureAtlas::Update() {
+    if (mReady) {
+        return false;
+    }
+    if (!mJobs.empty()) {
+        // Array sizes and layer counts are only known once every image is in
+        for (std::future<LoadedImage>& Job : mJobs) {
+            if (Job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return false;
+            }
+        }
+        // Arrays point into the images, so they must not reallocate
+        mImages.reserve(mJobs.size());
+        for (std::future<LoadedImage>& Job : mJobs) {
+            mImages.push_back(Job.get());
+            std::cout << mImages.back().Log;
+        }
+        mJobs.clear();
+        pack();
+    }
+
+    // At least one array per call so a tiny budget still makes progress
+    const auto StartTime = std::chrono::steady_clock::now();
+    while (mUploaded < mArrays.size()) {
+        upload(mArrays[mUploaded], mContents[mUploaded]);
+        ++mUploaded;
+        if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count() >= TextureCache::GetUploadBudget()) {
+            break;
+        }
+    }
+    if (mUploaded < mArrays.size()) {
+        return false;
+    }
+    mContents.clear();
+    mImages.clear();
+    mReady = true;
+    std::cout << "Packed " << mPaths.size() << " textures into " << mArrays.size() << " texture arrays, "
+              << mBytes / 1024 << " KiB" << std::endl;
+    return true;
+}
+
+bool
+TextureAtlas::IsReady() const {
+    return mReady;
+}
+
+void
+TextureAtlas::pack() {
+    GLint MaxLayers = 256;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &MaxLayers);
+    auto Place = [&](const LoadedImage& Image) {
+        const bool Compressed = !Image.Compressed.Levels.empty();
+        const int Width = Compressed ? Image.Compressed.Levels[0].Width : Image.Decoded.Width;
+        const int Height = Compressed ? Image.Compressed.Levels[0].Height : Image.Decoded.Height;
+        const GLenum Format = Compressed ? Image.Compressed.Format : GL_RGBA8;
+        auto Match = std::find_if(mArrays.begin(), mArrays.end(), [&](const Array& Candidate) {
+            return Candidate.Width == Width && Candidate.Height == Height && Candidate.Format == Format && Candidate.Layers < MaxLayers;
+        });
+        if (Match == mArrays.end()) {
+            mArrays.push_back({ 0, Width, Height, Format, 0 });
+            mContents.emplace_back();
+            Match = mArrays.end() - 1;
+        }
+        const int Index = static_cast<int>(Match - mArrays.begin());
+        mContents[Index].push_back(&Image);
+        return AtlasSlot{ Index, Match->Layers++ };
+    };
+
+    bool NeedsMissing = false;
+    for (size_t PathIdx = 0; PathIdx < mPaths.size(); ++PathIdx) {
+        if (isLoaded(mImages[PathIdx])) {
+            mSlots[mPaths[PathIdx]] = Place(mImages[PathIdx]);
+        }
+        else {
+            if (!mPaths[PathIdx].empty()) {
+                std::cerr << "Failed to load texture: " << mPaths[PathIdx] << " loading default instead" << std::endl;
+            }
+            NeedsMissing = true;
+        }
+    }
+    if (NeedsMissing && isLoaded(mImages.back())) {
+        mMissing = Place(mImages.back());
+    }
+    for (auto& Slot : mSlots) {
+        if (Slot.second.Array < 0) {
+            Slot.second = mMissing;
+        }
+    }
+}
+
+void
+TextureAtlas::upload(Array& target, const std::vector<const LoadedImage*>& images) {
+    const SamplerParams Sampler;
+    glGenTextures(1, &target.Texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, target.Texture);
+    if (target.Format != GL_RGBA8) {
+        // Cooked images of one size have the same number of levels
+        const GLsizei LevelCount = static_cast<GLsizei>(images[0]->Compressed.Levels.size());
+        if (GLEW_ARB_texture_storage) {
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, LevelCount, target.Format, target.Width, target.Height, target.Layers);
+        }
+        else {
+            for (GLsizei Level = 0; Level < LevelCount; ++Level) {
+                const CompressedLevel& Source = images[0]->Compressed.Levels[Level];
+                const GLsizei Size = static_cast<GLsizei>(Source.Data.size()) * target.Layers;
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, Level, target.Format, Source.Width, Source.Height, target.Layers, 0, Size, nullptr);
+            }
+        }
+        for (GLsizei Layer = 0; Layer < target.Layers; ++Layer) {
+            for (GLsizei Level = 0; Level < LevelCount; ++Level) {
+                const CompressedLevel& Source = images[Layer]->Compressed.Levels[Level];
+                const GLsizei Size = static_cast<GLsizei>(Source.Data.size());
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, Level, 0, 0, Layer, Source.Width, Source.Height, 1, target.Format, Size, Source.Data.data());
+                mBytes += Source.Data.size();
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, LevelCount - 1);
+    }
+    else {
+        if (GLEW_ARB_texture_storage) {
+            GLsizei LevelCount = 1;
+            while ((std::max(target.Width, target.Height) >> LevelCount) > 0) {
+                ++LevelCount;
+            }
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, LevelCount, GL_RGBA8, target.Width, target.Height, target.Layers);
+        }
+        else {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, target.Width, target.Height, target.Layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        for (GLsizei Layer = 0; Layer < target.Layers; ++Layer) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, Layer, target.Width, target.Height, 1, GL_RGBA, GL_UNSIGNED_BYTE, images[Layer]->Decoded.Pixels.get());
+        }
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        mBytes += static_cast<size_t>(target.Width) * target.Height * 4 * target.Layers * 4 / 3;
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, Sampler.WrapS);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, Sampler.WrapT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, Sampler.MinFilter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, Sampler.MagFilter);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+AtlasSlot
+TextureAtlas::Find(const std::string& filePath) const {
+    if (!mReady) {
+        return AtlasSlot();
+    }
+    auto It = mSlots.find(slotKey(filePath));
+    return It != mSlots.end() ? It->second : mMissing;
+}
+
+void
+TextureAtlas::Bind(int array, unsigned unit) const {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array >= 0 ? mArrays[array].Texture : mPlaceholder);
+    ++sBinds;
+}
+
+unsigned
+TextureAtlas::GetArrayCount() const {
+    return static_cast<unsigned>(mArrays.size());
+}
+
+unsigned
+TextureAtlas::GetLayerCount() const {
+    unsigned Layers = 0;
+    for (const Array& Target : mArrays) {
+        Layers += Target.Layers;
+    }
+    return Layers;
+}
+
+size_t
+TextureAtlas::GetVideoMemoryBytes() const {
+    return mBytes;
+}
+
+unsigned
+TextureAtlas::GetBindCount() {
+    return sBinds;
+}
+
+void
+TextureAtlas::ResetBindCount() {
+    sBinds = 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <future>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <GL/glew.h>
+#include "texture.hpp"
+
+// Where an image ended up in an atlas, Array is -1 when it is not in one
+struct AtlasSlot {
+    int Array = -1;
+    int Layer = 0;
+};
+
+// Packs the images of a model into GL_TEXTURE_2D_ARRAY textures, one array
+// per combination of size and format, so all meshes whose images share a size
+// draw with one texture binding and pick their image by layer. Images that
+// fail to load and empty paths share a layer holding the missing texture.
+// Paths are told apart by the same canonical form as the texture cache keys,
+// and every image added counts as a cache hit or miss.
+//
+// Images load on the shared thread pool without blocking the GL thread. Until
+// the arrays are uploaded every slot draws a grey placeholder layer.
+class TextureAtlas {
+
+private:
+    struct Array {
+        unsigned Texture;
+        int Width;
+        int Height;
+        GLenum Format;
+        int Layers;
+    };
+
+    std::vector<std::string> mPaths;
+    std::unordered_map<std::string, AtlasSlot> mSlots;
+    std::vector<Array> mArrays;
+    AtlasSlot mMissing;
+    size_t mBytes = 0;
+    std::vector<std::future<LoadedImage>> mJobs;
+    // Loaded images and the layers of every array, kept until it is uploaded
+    std::vector<LoadedImage> mImages;
+    std::vector<std::vector<const LoadedImage*>> mContents;
+    size_t mUploaded = 0;
+    bool mReady = false;
+    unsigned mPlaceholder = 0;
+    static unsigned sBinds;
+
+    void pack();
+    void upload(Array& target, const std::vector<const LoadedImage*>& images);
+
+public:
+    TextureAtlas() = default;
+    ~TextureAtlas();
+    TextureAtlas(const TextureAtlas&) = delete;
+    TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+    // Paths are loaded when the atlas is built, adding one twice is harmless
+    void Add(const std::string& filePath);
+    // Starts loading the added images on the shared thread pool and returns,
+    // has to run on the thread that owns the context
+    void Build();
+    // Call once per frame on the GL thread. Packs the images once all are
+    // loaded and uploads the arrays within the texture upload budget. Returns
+    // true on the call that made the slots final.
+    bool Update();
+    bool IsReady() const;
+    // The placeholder slot until the atlas is ready
+    AtlasSlot Find(const std::string& filePath) const;
+    void Bind(int array, unsigned unit) const;
+    unsigned GetArrayCount() const;
+    unsigned GetLayerCount() const;
+    size_t GetVideoMemoryBytes() const;
+    // Array bindings made since the last reset
+    static unsigned GetBindCount();
+    static void ResetBindCount();
+};
@@ -0,0 +1,506 @@
+#include "texture_cooker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// Vulkan formats and data format descriptor color models used in KTX2
+static const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+static const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+static const uint32_t VK_FORMAT_BC4_UNORM_BLOCK = 139;
+static const uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+static const uint32_t KHR_DF_MODEL_BC1A = 128;
+static const uint32_t KHR_DF_MODEL_BC3 = 130;
+static const uint32_t KHR_DF_MODEL_BC4 = 131;
+static const uint32_t KHR_DF_MODEL_BC5 = 132;
+
+struct Ktx2Header {
+    unsigned char Identifier[12];
+    uint32_t VkFormat;
+    uint32_t TypeSize;
+    uint32_t PixelWidth;
+    uint32_t PixelHeight;
+    uint32_t PixelDepth;
+    uint32_t LayerCount;
+    uint32_t FaceCount;
+    uint32_t LevelCount;
+    uint32_t SupercompressionScheme;
+    uint32_t DfdByteOffset;
+    uint32_t DfdByteLength;
+    uint32_t KvdByteOffset;
+    uint32_t KvdByteLength;
+    uint64_t SgdByteOffset;
+    uint64_t SgdByteLength;
+};
+
+struct Ktx2Level {
+    uint64_t ByteOffset;
+    uint64_t ByteLength;
+    uint64_t UncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header has to be packed");
+
+static unsigned
+blockBytes(GLenum format) {
+    return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+}
+
+static size_t
+levelBytes(GLenum format, int width, int height) {
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+static uint32_t
+vkFormatOf(GLenum format) {
+    switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return VK_FORMAT_BC3_UNORM_BLOCK;
+    case GL_COMPRESSED_RED_RGTC1: return VK_FORMAT_BC4_UNORM_BLOCK;
+    case GL_COMPRESSED_RG_RGTC2: return VK_FORMAT_BC5_UNORM_BLOCK;
+    default: return 0;
+    }
+}
+
+static GLenum
+glFormatOf(uint32_t vkFormat) {
+    switch (vkFormat) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case VK_FORMAT_BC3_UNORM_BLOCK: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case VK_FORMAT_BC4_UNORM_BLOCK: return GL_COMPRESSED_RED_RGTC1;
+    case VK_FORMAT_BC5_UNORM_BLOCK: return GL_COMPRESSED_RG_RGTC2;
+    default: return 0;
+    }
+}
+
+static uint16_t
+to565(const float color[3]) {
+    const unsigned R = static_cast<unsigned>(std::lround(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f));
+    const unsigned G = static_cast<unsigned>(std::lround(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f));
+    const unsigned B = static_cast<unsigned>(std::lround(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f));
+    return static_cast<uint16_t>((R << 11) | (G << 5) | B);
+}
+
+static void
+from565(uint16_t packed, float color[3]) {
+    color[0] = static_cast<float>((packed >> 11) & 31) * 255.0f / 31.0f;
+    color[1] = static_cast<float>((packed >> 5) & 63) * 255.0f / 63.0f;
+    color[2] = static_cast<float>(packed & 31) * 255.0f / 31.0f;
+}
+
+// Endpoints are the extremes of the block along its principal axis
+static void
+encodeColorBlock(const unsigned char texels[16][4], unsigned char* out) {
+    float Mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            Mean[c] += texels[i][c] / 16.0f;
+        }
+    }
+    float Covariance[3][3] = {};
+    for (int i = 0; i < 16; ++i) {
+        const float D[3] = { texels[i][0] - Mean[0], texels[i][1] - Mean[1], texels[i][2] - Mean[2] };
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                Covariance[r][c] += D[r] * D[c];
+            }
+        }
+    }
+    float Axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int Iteration = 0; Iteration < 8; ++Iteration) {
+        float Next[3];
+        for (int r = 0; r < 3; ++r) {
+            Next[r] = Covariance[r][0] * Axis[0] + Covariance[r][1] * Axis[1] + Covariance[r][2] * Axis[2];
+        }
+        const float Length = std::sqrt(Next[0] * Next[0] + Next[1] * Next[1] + Next[2] * Next[2]);
+        if (Length < 1e-6f) {
+            break;
+        }
+        for (int c = 0; c < 3; ++c) {
+            Axis[c] = Next[c] / Length;
+        }
+    }
+
+    float MinT = 0.0f;
+    float MaxT = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        const float T = (texels[i][0] - Mean[0]) * Axis[0] + (texels[i][1] - Mean[1]) * Axis[1] + (texels[i][2] - Mean[2]) * Axis[2];
+        MinT = std::min(MinT, T);
+        MaxT = std::max(MaxT, T);
+    }
+    float End0[3];
+    float End1[3];
+    for (int c = 0; c < 3; ++c) {
+        End0[c] = Mean[c] + Axis[c] * MaxT;
+        End1[c] = Mean[c] + Axis[c] * MinT;
+    }
+    uint16_t Packed0 = to565(End0);
+    uint16_t Packed1 = to565(End1);
+    // Color0 above color1 selects the four color mode
+    if (Packed0 < Packed1) {
+        std::swap(Packed0, Packed1);
+    }
+
+    uint32_t Indices = 0;
+    if (Packed0 != Packed1) {
+        float Palette[4][3];
+        from565(Packed0, Palette[0]);
+        from565(Packed1, Palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            Palette[2][c] = (2.0f * Palette[0][c] + Palette[1][c]) / 3.0f;
+            Palette[3][c] = (Palette[0][c] + 2.0f * Palette[1][c]) / 3.0f;
+        }
+        for (int i = 0; i < 16; ++i) {
+            unsigned Best = 0;
+            float BestDistance = 1e30f;
+            for (unsigned p = 0; p < 4; ++p) {
+                float Distance = 0.0f;
+                for (int c = 0; c < 3; ++c) {
+                    const float D = texels[i][c] - Palette[p][c];
+                    Distance += D * D;
+                }
+                if (Distance < BestDistance) {
+                    BestDistance = Distance;
+                    Best = p;
+                }
+            }
+            Indices |= Best << (2 * i);
+        }
+    }
+
+    out[0] = Packed0 & 0xFF;
+    out[1] = Packed0 >> 8;
+    out[2] = Packed1 & 0xFF;
+    out[3] = Packed1 >> 8;
+    for (int b = 0; b < 4; ++b) {
+        out[4 + b] = (Indices >> (8 * b)) & 0xFF;
+    }
+}
+
+// Eight value mode with the maximum as the first endpoint
+static void
+encodeChannelBlock(const unsigned char texels[16][4], int channel, unsigned char* out) {
+    unsigned char Min = 255;
+    unsigned char Max = 0;
+    for (int i = 0; i < 16; ++i) {
+        Min = std::min(Min, texels[i][channel]);
+        Max = std::max(Max, texels[i][channel]);
+    }
+
+    uint64_t Indices = 0;
+    if (Max != Min) {
+        const float Range = static_cast<float>(Max - Min);
+        for (int i = 0; i < 16; ++i) {
+            const int Step = static_cast<int>(std::lround((Max - texels[i][channel]) * 7.0f / Range));
+            const uint64_t Code = Step == 0 ? 0 : Step == 7 ? 1 : Step + 1;
+            Indices |= Code << (3 * i);
+        }
+    }
+
+    out[0] = Max;
+    out[1] = Min;
+    for (int b = 0; b < 6; ++b) {
+        out[2 + b] = (Indices >> (8 * b)) & 0xFF;
+    }
+}
+
+static void
+encodeLevel(GLenum format, const std::vector<unsigned char>& rgba, int width, int height, std::vector<unsigned char>& data) {
+    const unsigned Bytes = blockBytes(format);
+    data.resize(levelBytes(format, width, height));
+    unsigned char* Out = data.data();
+    for (int BlockY = 0; BlockY < height; BlockY += 4) {
+        for (int BlockX = 0; BlockX < width; BlockX += 4) {
+            // Partial blocks repeat the edge texels
+            unsigned char Texels[16][4];
+            for (int y = 0; y < 4; ++y) {
+                for (int x = 0; x < 4; ++x) {
+                    const int SourceX = std::min(BlockX + x, width - 1);
+                    const int SourceY = std::min(BlockY + y, height - 1);
+                    std::memcpy(Texels[4 * y + x], &rgba[(static_cast<size_t>(SourceY) * width + SourceX) * 4], 4);
+                }
+            }
+            switch (format) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+                encodeColorBlock(Texels, Out);
+                break;
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                encodeChannelBlock(Texels, 3, Out);
+                encodeColorBlock(Texels, Out + 8);
+                break;
+            case GL_COMPRESSED_RED_RGTC1:
+                encodeChannelBlock(Texels, 0, Out);
+                break;
+            case GL_COMPRESSED_RG_RGTC2:
+                encodeChannelBlock(Texels, 0, Out);
+                encodeChannelBlock(Texels, 1, Out + 8);
+                break;
+            }
+            Out += Bytes;
+        }
+    }
+}
+
+// Box filter over 2x2 texels. For odd sizes the last row or column is folded
+// into the last output texel, which then averages 3 texels per axis.
+static std::vector<unsigned char>
+downsample(const std::vector<unsigned char>& rgba, int width, int height, int& nextWidth, int& nextHeight) {
+    nextWidth = std::max(1, width / 2);
+    nextHeight = std::max(1, height / 2);
+    std::vector<unsigned char> Next(static_cast<size_t>(nextWidth) * nextHeight * 4);
+    for (int y = 0; y < nextHeight; ++y) {
+        const int Y0 = std::min(2 * y, height - 1);
+        const int Y1 = y == nextHeight - 1 ? height - 1 : 2 * y + 1;
+        for (int x = 0; x < nextWidth; ++x) {
+            const int X0 = std::min(2 * x, width - 1);
+            const int X1 = x == nextWidth - 1 ? width - 1 : 2 * x + 1;
+            const unsigned Count = static_cast<unsigned>((Y1 - Y0 + 1) * (X1 - X0 + 1));
+            for (int c = 0; c < 4; ++c) {
+                unsigned Sum = 0;
+                for (int SourceY = Y0; SourceY <= Y1; ++SourceY) {
+                    for (int SourceX = X0; SourceX <= X1; ++SourceX) {
+                        Sum += rgba[(static_cast<size_t>(SourceY) * width + SourceX) * 4 + c];
+                    }
+                }
+                Next[(static_cast<size_t>(y) * nextWidth + x) * 4 + c] = static_cast<unsigned char>((Sum + Count / 2) / Count);
+            }
+        }
+    }
+    return Next;
+}
+
+static uint64_t
+fnv1a(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ull) {
+    const unsigned char* Bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= Bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+GLenum
+TextureCooker::SelectFormat(int channels) {
+    switch (channels) {
+    case 1: return GL_COMPRESSED_RED_RGTC1;
+    case 2: return GL_COMPRESSED_RG_RGTC2;
+    case 4: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    default: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    }
+}
+
+bool
+TextureCooker::Cook(const unsigned char* pixels, int width, int height, int channels, CompressedImage& image) {
+    if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+        return false;
+    }
+
+    // Expand to RGBA once so that every level and format reads the same layout
+    std::vector<unsigned char> Rgba(static_cast<size_t>(width) * height * 4);
+    for (size_t Texel = 0; Texel < static_cast<size_t>(width) * height; ++Texel) {
+        const unsigned char* Source = pixels + Texel * channels;
+        unsigned char* Target = &Rgba[Texel * 4];
+        Target[0] = Source[0];
+        Target[1] = channels > 1 ? Source[1] : 0;
+        Target[2] = channels > 2 ? Source[2] : 0;
+        Target[3] = channels > 3 ? Source[3] : 255;
+    }
+
+    image.Format = SelectFormat(channels);
+    image.Levels.clear();
+    int LevelWidth = width;
+    int LevelHeight = height;
+    for (;;) {
+        CompressedLevel Level;
+        Level.Width = LevelWidth;
+        Level.Height = LevelHeight;
+        encodeLevel(image.Format, Rgba, LevelWidth, LevelHeight, Level.Data);
+        image.Levels.push_back(std::move(Level));
+        if (LevelWidth == 1 && LevelHeight == 1) {
+            break;
+        }
+        Rgba = downsample(Rgba, LevelWidth, LevelHeight, LevelWidth, LevelHeight);
+    }
+    return true;
+}
+
+bool
+TextureCooker::WriteKtx2(const std::string& path, const CompressedImage& image) {
+    const uint32_t VkFormat = vkFormatOf(image.Format);
+    if (!VkFormat || image.Levels.empty()) {
+        return false;
+    }
+
+    // Basic data format descriptor with one sample per 64 bit block half
+    std::vector<uint32_t> Samples;
+    uint32_t ColorModel = KHR_DF_MODEL_BC1A;
+    switch (image.Format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        Samples = { 0u | (63u << 16) | (0u << 24), 0, 0, 0xFFFFFFFF };
+        break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        ColorModel = KHR_DF_MODEL_BC3;
+        Samples = { 0u | (63u << 16) | (15u << 24), 0, 0, 0xFFFFFFFF, 64u | (63u << 16) | (0u << 24), 0, 0, 0xFFFFFFFF };
+        break;
+    case GL_COMPRESSED_RED_RGTC1:
+        ColorModel = KHR_DF_MODEL_BC4;
+        Samples = { 0u | (63u << 16) | (0u << 24), 0, 0, 0xFFFFFFFF };
+        break;
+    case GL_COMPRESSED_RG_RGTC2:
+        ColorModel = KHR_DF_MODEL_BC5;
+        Samples = { 0u | (63u << 16) | (0u << 24), 0, 0, 0xFFFFFFFF, 64u | (63u << 16) | (1u << 24), 0, 0, 0xFFFFFFFF };
+        break;
+    }
+    const uint32_t DescriptorBlockSize = 24 + static_cast<uint32_t>(Samples.size()) * 4;
+    std::vector<uint32_t> Dfd = {
+        4 + DescriptorBlockSize,
+        0,
+        2u | (DescriptorBlockSize << 16),
+        ColorModel | (1u << 8) | (1u << 16),
+        3u | (3u << 8),
+        blockBytes(image.Format),
+        0,
+    };
+    Dfd.insert(Dfd.end(), Samples.begin(), Samples.end());
+
+    const uint32_t LevelCount = static_cast<uint32_t>(image.Levels.size());
+    Ktx2Header Header = {};
+    std::memcpy(Header.Identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    Header.VkFormat = VkFormat;
+    Header.TypeSize = 1;
+    Header.PixelWidth = image.Levels[0].Width;
+    Header.PixelHeight = image.Levels[0].Height;
+    Header.FaceCount = 1;
+    Header.LevelCount = LevelCount;
+    Header.DfdByteOffset = static_cast<uint32_t>(sizeof(Header) + LevelCount * sizeof(Ktx2Level));
+    Header.DfdByteLength = static_cast<uint32_t>(Dfd.size() * sizeof(uint32_t));
+
+    // Level data goes smallest first, each level aligned to its block size
+    const uint64_t Alignment = blockBytes(image.Format);
+    std::vector<Ktx2Level> Index(LevelCount);
+    uint64_t Offset = Header.DfdByteOffset + Header.DfdByteLength;
+    for (uint32_t Level = LevelCount; Level-- > 0;) {
+        Offset = (Offset + Alignment - 1) / Alignment * Alignment;
+        Index[Level].ByteOffset = Offset;
+        Index[Level].ByteLength = image.Levels[Level].Data.size();
+        Index[Level].UncompressedByteLength = image.Levels[Level].Data.size();
+        Offset += image.Levels[Level].Data.size();
+    }
+
+    std::error_code Error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), Error);
+    // Several workers may cook the same image at once, each writes its own file
+    static std::atomic<unsigned> sTempCounter(0);
+    const std::string TempPath = path + "." + std::to_string(sTempCounter++) + ".tmp";
+    {
+        std::ofstream Out(TempPath, std::ios::binary | std::ios::trunc);
+        if (!Out.is_open()) {
+            std::cerr << "Unable to save data to file: " << path << std::endl;
+            return false;
+        }
+        Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+        Out.write(reinterpret_cast<const char*>(Index.data()), Index.size() * sizeof(Ktx2Level));
+        Out.write(reinterpret_cast<const char*>(Dfd.data()), Dfd.size() * sizeof(uint32_t));
+        uint64_t Written = Header.DfdByteOffset + Header.DfdByteLength;
+        for (uint32_t Level = LevelCount; Level-- > 0;) {
+            static const char Padding[16] = {};
+            Out.write(Padding, Index[Level].ByteOffset - Written);
+            Out.write(reinterpret_cast<const char*>(image.Levels[Level].Data.data()), Index[Level].ByteLength);
+            Written = Index[Level].ByteOffset + Index[Level].ByteLength;
+        }
+    }
+    std::remove(path.c_str());
+    if (std::rename(TempPath.c_str(), path.c_str()) != 0) {
+        std::remove(TempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool
+TextureCooker::ReadKtx2(const std::string& path, CompressedImage& image) {
+    std::ifstream In(path, std::ios::binary | std::ios::ate);
+    if (!In.is_open()) {
+        return false;
+    }
+    const uint64_t FileSize = static_cast<uint64_t>(In.tellg());
+    In.seekg(0);
+
+    Ktx2Header Header;
+    In.read(reinterpret_cast<char*>(&Header), sizeof(Header));
+    if (!In || std::memcmp(Header.Identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0
+        || !glFormatOf(Header.VkFormat) || Header.SupercompressionScheme != 0
+        || Header.LevelCount == 0 || Header.LevelCount > 32 || Header.FaceCount != 1 || Header.LayerCount > 1) {
+        return false;
+    }
+
+    std::vector<Ktx2Level> Index(Header.LevelCount);
+    In.read(reinterpret_cast<char*>(Index.data()), Index.size() * sizeof(Ktx2Level));
+    if (!In) {
+        return false;
+    }
+
+    image.Format = glFormatOf(Header.VkFormat);
+    image.Levels.resize(Header.LevelCount);
+    for (uint32_t Level = 0; Level < Header.LevelCount; ++Level) {
+        CompressedLevel& Target = image.Levels[Level];
+        Target.Width = std::max(1, static_cast<int>(Header.PixelWidth >> Level));
+        Target.Height = std::max(1, static_cast<int>(Header.PixelHeight >> Level));
+        if (Index[Level].ByteLength != levelBytes(image.Format, Target.Width, Target.Height)
+            || Index[Level].ByteOffset + Index[Level].ByteLength > FileSize) {
+            std::cerr << "Rebuilding stale texture cache entry: " << path << std::endl;
+            return false;
+        }
+        Target.Data.resize(static_cast<size_t>(Index[Level].ByteLength));
+        In.seekg(static_cast<std::streamoff>(Index[Level].ByteOffset));
+        In.read(reinterpret_cast<char*>(Target.Data.data()), Target.Data.size());
+        if (!In) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string
+TextureCooker::CachePath(const std::string& sourcePath) {
+    std::error_code Error;
+    const uintmax_t Size = std::filesystem::file_size(sourcePath, Error);
+    if (Error) {
+        return "";
+    }
+    const auto Time = std::filesystem::last_write_time(sourcePath, Error).time_since_epoch().count();
+    if (Error) {
+        return "";
+    }
+    std::string Canonical = std::filesystem::weakly_canonical(sourcePath, Error).generic_string();
+    if (Error) {
+        Canonical = sourcePath;
+    }
+
+    const uint32_t Version = TEXTURE_COOKER_VERSION;
+    uint64_t Hash = fnv1a(&Version, sizeof(Version));
+    Hash = fnv1a(Canonical.data(), Canonical.size(), Hash);
+    Hash = fnv1a(&Size, sizeof(Size), Hash);
+    Hash = fnv1a(&Time, sizeof(Time), Hash);
+
+    char Hex[17];
+    std::snprintf(Hex, sizeof(Hex), "%016llx", static_cast<unsigned long long>(Hash));
+    return std::string(TEXTURE_CACHE_DIRECTORY) + "/" + Hex + ".ktx2";
+}
+
+size_t
+TextureCooker::GetByteSize(const CompressedImage& image) {
+    size_t Bytes = 0;
+    for (const CompressedLevel& Level : image.Levels) {
+        Bytes += Level.Data.size();
+    }
+    return Bytes;
+}
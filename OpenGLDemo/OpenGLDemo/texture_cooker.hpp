@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#define TEXTURE_CACHE_DIRECTORY "texture_data"
+// Bump whenever the cooked output changes for the same source image
+#define TEXTURE_COOKER_VERSION 2
+
+struct CompressedLevel {
+    int Width;
+    int Height;
+    std::vector<unsigned char> Data;
+};
+
+// Block compressed image with its full mip chain, level 0 first
+struct CompressedImage {
+    GLenum Format = 0;
+    std::vector<CompressedLevel> Levels;
+};
+
+// Turns decoded images into block compressed mip chains and stores them as
+// KTX2 files. The format follows the channel count: BC4 for one channel, BC5
+// for two, BC1 for three and BC3 for four. Nothing here touches GL state.
+class TextureCooker {
+
+public:
+    static GLenum SelectFormat(int channels);
+    static bool Cook(const unsigned char* pixels, int width, int height, int channels, CompressedImage& image);
+    static bool WriteKtx2(const std::string& path, const CompressedImage& image);
+    static bool ReadKtx2(const std::string& path, CompressedImage& image);
+    // Cache entry for a source image, keyed by its path, size and modification
+    // time. Empty when the source does not exist.
+    static std::string CachePath(const std::string& sourcePath);
+    static size_t GetByteSize(const CompressedImage& image);
+};
@@ -0,0 +1,100 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    mWorkers.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i) {
+        mWorkers.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> Lock(mMutex);
+        mStop = true;
+    }
+    mWakeUp.notify_all();
+    for (std::thread& Worker : mWorkers) {
+        Worker.join();
+    }
+}
+
+unsigned
+ThreadPool::GetThreadCount() const {
+    return static_cast<unsigned>(mWorkers.size());
+}
+
+void
+ThreadPool::run() {
+    for (;;) {
+        std::function<void()> Task;
+        {
+            std::unique_lock<std::mutex> Lock(mMutex);
+            mWakeUp.wait(Lock, [this] { return mStop || !mTasks.empty() || mBatchNext < mBatchCount; });
+            if (mBatchNext < mBatchCount) {
+                const unsigned Index = mBatchNext++;
+                const auto Job = mBatchJob;
+                const void* Context = mBatchContext;
+                Lock.unlock();
+                Job(Context, Index);
+                finishBatchIndex();
+                continue;
+            }
+            if (mTasks.empty()) return;
+            Task = std::move(mTasks.front());
+            mTasks.pop_front();
+        }
+        Task();
+    }
+}
+
+void
+ThreadPool::finishBatchIndex() {
+    std::lock_guard<std::mutex> Lock(mMutex);
+    if (--mBatchPending == 0) {
+        mBatchFinished.notify_all();
+    }
+}
+
+void
+ThreadPool::runBatch(unsigned count, void (*job)(const void*, unsigned), const void* context) {
+    if (!count) {
+        return;
+    }
+    std::lock_guard<std::mutex> Caller(mBatchCaller);
+    {
+        std::lock_guard<std::mutex> Lock(mMutex);
+        mBatchJob = job;
+        mBatchContext = context;
+        mBatchNext = 0;
+        mBatchCount = count;
+        mBatchPending = count;
+    }
+    mWakeUp.notify_all();
+    // The caller takes indices as well, so the batch finishes even while every
+    // worker is busy with a long task
+    for (;;) {
+        unsigned Index;
+        {
+            std::lock_guard<std::mutex> Lock(mMutex);
+            if (mBatchNext >= mBatchCount) {
+                break;
+            }
+            Index = mBatchNext++;
+        }
+        job(context, Index);
+        finishBatchIndex();
+    }
+    std::unique_lock<std::mutex> Lock(mMutex);
+    mBatchFinished.wait(Lock, [this] { return mBatchPending == 0; });
+    mBatchNext = 0;
+    mBatchCount = 0;
+}
+
+ThreadPool&
+ThreadPool::Shared() {
+    static ThreadPool Pool(std::thread::hardware_concurrency());
+    return Pool;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for CPU work that must not touch GL state.
+class ThreadPool {
+
+private:
+    std::vector<std::thread> mWorkers;
+    std::deque<std::function<void()>> mTasks;
+    std::mutex mMutex;
+    std::condition_variable mWakeUp;
+    bool mStop = false;
+    // Job of the running ParallelFor, workers take its indices before queued
+    // tasks. Kept in plain members so a batch allocates nothing.
+    void (*mBatchJob)(const void*, unsigned) = nullptr;
+    const void* mBatchContext = nullptr;
+    unsigned mBatchNext = 0;
+    unsigned mBatchCount = 0;
+    unsigned mBatchPending = 0;
+    std::condition_variable mBatchFinished;
+    std::mutex mBatchCaller;
+
+    void run();
+    void finishBatchIndex();
+    void runBatch(unsigned count, void (*job)(const void*, unsigned), const void* context);
+
+public:
+    explicit ThreadPool(unsigned threadCount);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned GetThreadCount() const;
+
+    template <typename Task>
+    auto Submit(Task&& task) -> std::future<decltype(task())> {
+        using Result = decltype(task());
+        auto Packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Task>(task));
+        std::future<Result> Future = Packaged->get_future();
+        {
+            std::lock_guard<std::mutex> Lock(mMutex);
+            mTasks.emplace_back([Packaged] { (*Packaged)(); });
+        }
+        mWakeUp.notify_one();
+        return Future;
+    }
+
+    // Calls job(index) for every index below count on the workers and the
+    // calling thread, and returns when all are done. Unlike Submit it does not
+    // allocate, for work repeated every frame.
+    template <typename Job>
+    void ParallelFor(unsigned count, const Job& job) {
+        runBatch(count, [](const void* Context, unsigned Index) { (*static_cast<const Job*>(Context))(Index); }, &job);
+    }
+
+    static ThreadPool& Shared();
+};
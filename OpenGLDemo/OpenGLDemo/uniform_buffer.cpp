@@ -0,0 +1,68 @@
+#include "uniform_buffer.hpp"
+
+#include <cstring>
+#include <iostream>
+
+static const char* BLOCK_NAMES[UNIFORM_BLOCK_COUNT] = { "FrameData", "LightData", "MaterialData" };
+
+unsigned UniformBuffer::sUpdates = 0;
+
+UniformBuffer::UniformBuffer(EUniformBlock block, size_t size) {
+    mBlock = block;
+    mContents.resize(size);
+    mValid = false;
+    glGenBuffers(1, &mId);
+    glBindBuffer(GL_UNIFORM_BUFFER, mId);
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, mBlock, mId);
+}
+
+UniformBuffer::~UniformBuffer() {
+    Release();
+}
+
+void
+UniformBuffer::Release() {
+    if (mId) {
+        glDeleteBuffers(1, &mId);
+        mId = 0;
+    }
+}
+
+void
+UniformBuffer::update(const void* data, size_t size) {
+    if (size != mContents.size()) {
+        std::cerr << "[Err] Wrong data size for uniform block " << BLOCK_NAMES[mBlock] << std::endl;
+        return;
+    }
+    if (mValid && std::memcmp(mContents.data(), data, size) == 0) {
+        return;
+    }
+    std::memcpy(mContents.data(), data, size);
+    mValid = true;
+    ++sUpdates;
+    glBindBuffer(GL_UNIFORM_BUFFER, mId);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+int
+UniformBuffer::FindBinding(const char* blockName) {
+    for (int Block = 0; Block < UNIFORM_BLOCK_COUNT; ++Block) {
+        if (std::strcmp(BLOCK_NAMES[Block], blockName) == 0) {
+            return Block;
+        }
+    }
+    return -1;
+}
+
+unsigned
+UniformBuffer::GetUpdateCount() {
+    return sUpdates;
+}
+
+void
+UniformBuffer::ResetUpdateCount() {
+    sUpdates = 0;
+}
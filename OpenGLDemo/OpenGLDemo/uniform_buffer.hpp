@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Binding points of the uniform blocks shared by all programs. Shaders are
+// bound to them by block name when they are linked.
+enum EUniformBlock {
+    FRAME_BLOCK = 0,
+    LIGHT_BLOCK = 1,
+    MATERIAL_BLOCK = 2,
+    UNIFORM_BLOCK_COUNT = 3,
+};
+
+// The structs below mirror the std140 layout of the blocks in the shaders,
+// padding included
+struct FrameData {
+    glm::mat4 Projection;
+    glm::mat4 View;
+    glm::vec3 ViewPos;
+    float Padding0;
+};
+
+struct PositionalLightData {
+    glm::vec3 Position;
+    float Padding0;
+    glm::vec3 Ka;
+    float Padding1;
+    glm::vec3 Kd;
+    float Padding2;
+    glm::vec3 Ks;
+    float Kc;
+    float Kl;
+    float Kq;
+    float Padding3[2];
+};
+
+struct DirectionalLightData {
+    glm::vec3 Position;
+    float Padding0;
+    glm::vec3 Direction;
+    float Padding1;
+    glm::vec3 Ka;
+    float Padding2;
+    glm::vec3 Kd;
+    float Padding3;
+    glm::vec3 Ks;
+    float InnerCutOff;
+    float OuterCutOff;
+    float Kc;
+    float Kl;
+    float Kq;
+};
+
+struct LightData {
+    PositionalLightData SunLight;
+    DirectionalLightData FlashLight;
+    DirectionalLightData DirLight;
+};
+
+struct MaterialData {
+    glm::vec3 Ka;
+    float Padding0;
+    glm::vec3 Kd;
+    float Padding1;
+    glm::vec3 Ks;
+    float Shininess;
+};
+
+static_assert(sizeof(FrameData) == 144, "FrameData does not match the std140 layout");
+static_assert(sizeof(PositionalLightData) == 80, "PositionalLightData does not match the std140 layout");
+static_assert(sizeof(DirectionalLightData) == 96, "DirectionalLightData does not match the std140 layout");
+static_assert(sizeof(LightData) == 272, "LightData does not match the std140 layout");
+static_assert(sizeof(MaterialData) == 48, "MaterialData does not match the std140 layout");
+
+// Uniform buffer bound to the binding point of one block. Keeps a copy of its
+// contents and only touches the buffer when new contents differ.
+class UniformBuffer {
+
+private:
+    unsigned mId;
+    EUniformBlock mBlock;
+    std::vector<unsigned char> mContents;
+    bool mValid;
+    static unsigned sUpdates;
+
+    void update(const void* data, size_t size);
+
+public:
+    UniformBuffer(EUniformBlock block, size_t size);
+    ~UniformBuffer();
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+    // Deletes the buffer while the context still exists, nothing may be Set after
+    void Release();
+
+    template <typename T>
+    void Set(const T& data) {
+        update(&data, sizeof(T));
+    }
+
+    // Binding point for a block name reported by the program, -1 if unknown
+    static int FindBinding(const char* blockName);
+    // Buffer updates since the last reset
+    static unsigned GetUpdateCount();
+    static void ResetUpdateCount();
+};
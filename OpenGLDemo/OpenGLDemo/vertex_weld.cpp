@@ -0,0 +1,210 @@
+#include "vertex_weld.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+static const unsigned NO_GROUP = 0xFFFFFFFF;
+
+static glm::vec3
+positionAt(const std::vector<float>& vertices, size_t offset) {
+    return glm::vec3(vertices[offset], vertices[offset + 1], vertices[offset + 2]);
+}
+
+static bool
+isNan(const glm::vec3& v) {
+    return std::isnan(v.x) || std::isnan(v.y) || std::isnan(v.z);
+}
+
+// Equal infinities differ by NaN but are the same position
+static bool
+withinTolerance(const glm::vec3& a, const glm::vec3& b, float tolerance) {
+    for (int Axis = 0; Axis < 3; ++Axis) {
+        if (a[Axis] != b[Axis] && !(std::abs(a[Axis] - b[Axis]) <= tolerance)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+VertexWeld::CellKey::operator==(const CellKey& other) const {
+    return x == other.x && y == other.y && z == other.z;
+}
+
+size_t
+VertexWeld::CellKeyHash::operator()(const CellKey& key) const {
+    uint64_t h = static_cast<uint64_t>(key.x) * 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<uint64_t>(key.y) * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+    h ^= static_cast<uint64_t>(key.z) * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+    return static_cast<size_t>(h);
+}
+
+VertexWeld::VertexWeld(const std::vector<float>& vertices, unsigned stride, float tolerance) {
+    mTolerance = tolerance;
+    groupVertices(vertices, stride);
+    accumulateNormals(vertices, stride);
+}
+
+// Far cells are clamped well inside int64 so their neighbours stay in range.
+// Positions that share a clamped cell are still compared exactly.
+static int64_t
+cellCoordinate(float value, float tolerance) {
+    const double CellLimit = 4611686018427387904.0;
+    const double Cell = std::floor(static_cast<double>(value) / tolerance);
+    return static_cast<int64_t>(std::max(-CellLimit, std::min(Cell, CellLimit)));
+}
+
+VertexWeld::CellKey
+VertexWeld::cellOf(const glm::vec3& position) const {
+    // Infinite positions have no cell, they take the exact key like without tolerance
+    if (mTolerance > 0.0f && std::isfinite(position.x) && std::isfinite(position.y) && std::isfinite(position.z)) {
+        return {
+            cellCoordinate(position.x, mTolerance),
+            cellCoordinate(position.y, mTolerance),
+            cellCoordinate(position.z, mTolerance)
+        };
+    }
+    // Adding zero folds -0.0 into +0.0 so the key follows float equality
+    const float Canonical[3] = { position.x + 0.0f, position.y + 0.0f, position.z + 0.0f };
+    uint32_t Bits[3];
+    std::memcpy(Bits, Canonical, sizeof(Bits));
+    return { Bits[0], Bits[1], Bits[2] };
+}
+
+void
+VertexWeld::groupVertices(const std::vector<float>& vertices, unsigned stride) {
+    const unsigned VertexCount = static_cast<unsigned>(vertices.size() / stride);
+    mGroupOfVertex.resize(VertexCount);
+
+    // Every cell points at the first group registered in it, further groups in
+    // the same cell are chained through NextInCell. Exact welding never chains.
+    std::unordered_map<CellKey, unsigned, CellKeyHash> Cells;
+    Cells.reserve(VertexCount);
+    std::vector<unsigned> NextInCell;
+
+    for (unsigned VertexIndex = 0; VertexIndex < VertexCount; ++VertexIndex) {
+        const glm::vec3 Position = positionAt(vertices, static_cast<size_t>(VertexIndex) * stride);
+        unsigned Group = NO_GROUP;
+
+        // NaN never compares equal, not even to itself, so it always stands alone
+        if (!isNan(Position)) {
+            const CellKey Cell = cellOf(Position);
+            if (mTolerance > 0.0f) {
+                for (int64_t dx = -1; dx <= 1; ++dx) {
+                    for (int64_t dy = -1; dy <= 1; ++dy) {
+                        for (int64_t dz = -1; dz <= 1; ++dz) {
+                            auto It = Cells.find({ Cell.x + dx, Cell.y + dy, Cell.z + dz });
+                            if (It == Cells.end()) continue;
+                            for (unsigned Candidate = It->second; Candidate != NO_GROUP; Candidate = NextInCell[Candidate]) {
+                                const glm::vec3 Other = positionAt(vertices, static_cast<size_t>(mFirstVertex[Candidate]) * stride);
+                                if (withinTolerance(Other, Position, mTolerance) && Candidate < Group) {
+                                    Group = Candidate;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            else {
+                auto It = Cells.find(Cell);
+                if (It != Cells.end()) {
+                    Group = It->second;
+                }
+            }
+
+            if (Group == NO_GROUP) {
+                Group = static_cast<unsigned>(mFirstVertex.size());
+                auto Inserted = Cells.emplace(Cell, Group);
+                NextInCell.push_back(Inserted.second ? NO_GROUP : Inserted.first->second);
+                Inserted.first->second = Group;
+                mFirstVertex.push_back(VertexIndex);
+            }
+        }
+        else {
+            Group = static_cast<unsigned>(mFirstVertex.size());
+            NextInCell.push_back(NO_GROUP);
+            mFirstVertex.push_back(VertexIndex);
+        }
+        mGroupOfVertex[VertexIndex] = Group;
+    }
+}
+
+void
+VertexWeld::accumulateNormals(const std::vector<float>& vertices, unsigned stride) {
+    const unsigned VertexCount = GetVertexCount();
+    const unsigned GroupCount = GetGroupCount();
+
+    // Bucket vertices by group while keeping them in vertex order, so that the
+    // sums below are formed in the same order as a front-to-back scan would.
+    std::vector<unsigned> GroupStart(GroupCount + 1, 0);
+    for (unsigned VertexIndex = 0; VertexIndex < VertexCount; ++VertexIndex) {
+        ++GroupStart[mGroupOfVertex[VertexIndex] + 1];
+    }
+    for (unsigned Group = 0; Group < GroupCount; ++Group) {
+        GroupStart[Group + 1] += GroupStart[Group];
+    }
+    std::vector<unsigned> Members(VertexCount);
+    std::vector<unsigned> Cursor(GroupStart.begin(), GroupStart.end() - 1);
+    for (unsigned VertexIndex = 0; VertexIndex < VertexCount; ++VertexIndex) {
+        Members[Cursor[mGroupOfVertex[VertexIndex]]++] = VertexIndex;
+    }
+
+    mNormalSum.assign(GroupCount, glm::vec3(0.0f));
+    mNormalCount.assign(GroupCount, 0);
+    std::vector<glm::vec3> UniqueNormals;
+    for (unsigned Group = 0; Group < GroupCount; ++Group) {
+        const glm::vec3 Position = positionAt(vertices, static_cast<size_t>(mFirstVertex[Group]) * stride);
+        if (isNan(Position)) continue;
+
+        UniqueNormals.clear();
+        glm::vec3 Sum(0.0f);
+        for (unsigned Member = GroupStart[Group]; Member < GroupStart[Group + 1]; ++Member) {
+            const glm::vec3 Normal = positionAt(vertices, static_cast<size_t>(Members[Member]) * stride + 3);
+            bool Seen = false;
+            for (const glm::vec3& Unique : UniqueNormals) {
+                if (Unique == Normal) {
+                    Seen = true;
+                    break;
+                }
+            }
+            if (!Seen) {
+                Sum += Normal;
+                UniqueNormals.push_back(Normal);
+            }
+        }
+        mNormalSum[Group] = Sum;
+        mNormalCount[Group] = static_cast<unsigned>(UniqueNormals.size());
+    }
+}
+
+unsigned
+VertexWeld::GetVertexCount() const {
+    return static_cast<unsigned>(mGroupOfVertex.size());
+}
+
+unsigned
+VertexWeld::GetGroupCount() const {
+    return static_cast<unsigned>(mFirstVertex.size());
+}
+
+unsigned
+VertexWeld::GetGroup(unsigned vertex) const {
+    return mGroupOfVertex[vertex];
+}
+
+unsigned
+VertexWeld::GetFirstVertex(unsigned group) const {
+    return mFirstVertex[group];
+}
+
+const glm::vec3&
+VertexWeld::GetNormalSum(unsigned group) const {
+    return mNormalSum[group];
+}
+
+unsigned
+VertexWeld::GetNormalCount(unsigned group) const {
+    return mNormalCount[group];
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Groups the vertices of an interleaved buffer (position at offset 0, normal at
+// offset 3) that share a position. With zero tolerance positions have to be
+// equal, otherwise vertices within the tolerance on every axis are welded
+// through a uniform grid. Groups are numbered in order of first occurrence.
+class VertexWeld {
+
+private:
+    struct CellKey {
+        int64_t x;
+        int64_t y;
+        int64_t z;
+        bool operator==(const CellKey& other) const;
+    };
+    struct CellKeyHash {
+        size_t operator()(const CellKey& key) const;
+    };
+
+    float mTolerance;
+    std::vector<unsigned> mGroupOfVertex;
+    std::vector<unsigned> mFirstVertex;
+    std::vector<glm::vec3> mNormalSum;
+    std::vector<unsigned> mNormalCount;
+
+    CellKey cellOf(const glm::vec3& position) const;
+    void groupVertices(const std::vector<float>& vertices, unsigned stride);
+    void accumulateNormals(const std::vector<float>& vertices, unsigned stride);
+
+public:
+    VertexWeld(const std::vector<float>& vertices, unsigned stride, float tolerance = 0.0f);
+    unsigned GetVertexCount() const;
+    unsigned GetGroupCount() const;
+    unsigned GetGroup(unsigned vertex) const;
+    unsigned GetFirstVertex(unsigned group) const;
+    const glm::vec3& GetNormalSum(unsigned group) const;
+    unsigned GetNormalCount(unsigned group) const;
+};